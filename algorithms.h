@@ -22,23 +22,19 @@ namespace s3d_graph
         // contains this node.   
         if(graph.get_valid())
         {
-            auto &edges = graph.get_edges_by_dst();
+            auto index = graph.index_of(node_id);
 
-            auto edge_it = std::lower_bound(
-                edges.begin(),
-                edges.end(),
-                node_id,
-                [](auto &e, auto &n) { return e.get_dst() < n; });
-
-            while ((edge_it != edges.end()) &&
-                   (edge_it->get_dst() == node_id))
+            if(index != dag<T>::invalid_index)
             {
-                out.emplace_back(edge_it->get_src());
-                ++edge_it;
-            }
+                for(auto src : graph.get_predecessors(index))
+                {
+                    out.emplace_back(graph.id_of(src));
+                }
 
-            std::sort(out.begin(), out.end());
-            out.erase(std::unique(out.begin(), out.end()), out.end());
+                // Rows are sorted already, so only duplicate edges need
+                // removing.
+                out.erase(std::unique(out.begin(), out.end()), out.end());
+            }
             return true;
         }
         else
@@ -62,23 +58,19 @@ namespace s3d_graph
         // contains this node.   
         if(graph.get_valid())
         {
-            auto &edges = graph.get_edges_by_src();
+            auto index = graph.index_of(node_id);
 
-            auto edge_it = std::lower_bound(
-                edges.begin(),
-                edges.end(),
-                node_id,
-                [](auto &e, auto &n) { return e.get_src() < n; });
-
-            while ((edge_it != edges.end()) &&
-                   (edge_it->get_src() == node_id))
+            if(index != dag<T>::invalid_index)
             {
-                out.emplace_back(edge_it->get_dst());
-                ++edge_it;
-            }
+                for(auto dst : graph.get_successors(index))
+                {
+                    out.emplace_back(graph.id_of(dst));
+                }
 
-            std::sort(out.begin(), out.end());
-            out.erase(std::unique(out.begin(), out.end()), out.end());
+                // Rows are sorted already, so only duplicate edges need
+                // removing.
+                out.erase(std::unique(out.begin(), out.end()), out.end());
+            }
             return true;
         }
         else
@@ -87,56 +79,209 @@ namespace s3d_graph
         }
     }
  
+    // Scratch space for the traversal algorithms, so that repeated queries
+    // on a graph don't allocate.  Create one per thread, sized for the
+    // graph; the overloads taking a workspace resize it if it's too small.
+    //
+    // Only the visited bitsets are sized up front.  Lists of node indices
+    // grow with the searches that use them, and the counters are only
+    // sized by find_current_tasks.
     template<typename T>
-    bool find_all_before(
-            dag<T> const &graph,
-            T node_id,
-            typename dag<T>::node_id_vector &out)
+    class traversal_workspace
     {
-        using node_id_vector    = typename dag<T>::node_id_vector;
+    public:
+        using index_vector  = typename dag<T>::index_vector;
+        using bitset_type   = std::vector<std::uint64_t>;
 
-        out.clear();
+        traversal_workspace()
+        {
+        }
 
-        // Ensure the graph is valid.  We don't actually care if it
-        // contains this node.   
-        if(graph.get_valid())
+        explicit traversal_workspace(dag<T> const &graph)
+        {
+            reserve(graph);
+        }
+
+        // Make sure the visited bitsets cover graph.  Only allocates if
+        // graph is larger than any graph this has been used with.
+        void reserve(dag<T> const &graph)
+        {
+            auto word_count = (graph.get_node_count() + 63) / 64;
+
+            if(m_visited.size() < word_count)
+            {
+                m_visited.resize(word_count, 0);
+                m_marked.resize(word_count, 0);
+            }
+        }
+
+        // As reserve(), also making sure there is a counter per node.
+        void reserve_counts(dag<T> const &graph)
         {
-            node_id_vector to_process;
-            auto &edges = graph.get_edges_by_dst();
+            reserve(graph);
+
+            auto node_count = graph.get_node_count();
+
+            if(m_counts.size() < node_count)
+            {
+                m_counts.resize(node_count, 0);
+            }
+        }
+
+        // Visited bitsets, one bit per node index.  Kept clear between
+        // queries.
+        bitset_type &get_visited() { return m_visited; }
+        bitset_type &get_marked() { return m_marked; }
+
+        // Stack of node indices.  Grows as needed.
+        index_vector &get_to_process() { return m_to_process; }
 
-            to_process.push_back(node_id);
+        // A second list of node indices, for searches in two directions.
+        // Grows as needed rather than being reserved.
+        index_vector &get_reverse_to_process() { return m_reverse_to_process; }
+
+        // A counter per node index, once reserve_counts() has been
+        // called.  Kept zeroed between queries.
+        index_vector &get_counts() { return m_counts; }
+
+    private:
+        bitset_type     m_visited,
+                        m_marked;
+
+        index_vector    m_to_process,
+                        m_reverse_to_process,
+                        m_counts;
+    };
+
+    namespace detail
+    {
+        // Index of the lowest set bit in a non-zero word.
+        inline unsigned lowest_bit(std::uint64_t word)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return unsigned(__builtin_ctzll(word));
+#else
+            unsigned bit = 0;
+
+            while((word & 1) == 0)
+            {
+                word >>= 1;
+                ++bit;
+            }
+
+            return bit;
+#endif
+        }
+
+        // Depth first search from start, following next(index), marking
+        // every node reached in the visited bitset.  start itself is only
+        // marked if it is reached again, which can't happen in a DAG.
+        template<typename T, typename NextFn>
+        void mark_reachable(
+                dag<T> const &graph,
+                typename dag<T>::index_type start,
+                NextFn next,
+                std::vector<std::uint64_t> &visited,
+                typename dag<T>::index_vector &to_process)
+        {
+            to_process.clear();
+            to_process.push_back(start);
 
-            // Depth first back up the graph.
             while(!to_process.empty())
             {
-                auto cur_id = to_process.back();
+                auto cur_index = to_process.back();
                 to_process.pop_back();
 
-                // Find all edges that point to this node.
-                auto edge_it = std::lower_bound(
-                    edges.begin(),
-                    edges.end(),
-                    cur_id,
-                    [](auto &e, auto &n) { return e.get_dst() < n; });
-
-                while((edge_it != edges.end()) && 
-                      (edge_it->get_dst() == cur_id))
+                for(auto next_index : next(graph, cur_index))
                 {
-                    // Find insertion point in output.
-                    auto ins_it = std::lower_bound(
-                        out.begin(),
-                        out.end(),
-                        edge_it->get_src());
-
-                    if((ins_it == out.end()) ||
-                       (edge_it->get_src() != *ins_it))
+                    auto &word = visited[next_index / 64];
+                    auto bit = std::uint64_t(1) << (next_index % 64);
+
+                    if((word & bit) == 0)
                     {
-                        out.insert(ins_it, edge_it->get_src());
-                        to_process.push_back(edge_it->get_src());
+                        word |= bit;
+                        to_process.push_back(next_index);
                     }
+                }
+            }
+        }
+
+        // Append ids of nodes marked in the visited bitset to out.  Indices
+        // are in id order, so the output is sorted.  Clears the bitset.
+        template<typename T>
+        void gather_marked(
+                dag<T> const &graph,
+                std::vector<std::uint64_t> &visited,
+                typename dag<T>::node_id_vector &out)
+        {
+            auto word_count = (graph.get_node_count() + 63) / 64;
+
+            for(size_t w = 0; w < word_count; ++w)
+            {
+                auto word = visited[w];
 
-                    ++edge_it;
+                while(word != 0)
+                {
+                    auto bit = lowest_bit(word);
+                    out.emplace_back(
+                        graph.id_of(typename dag<T>::index_type(w * 64 + bit)));
+                    word &= word - 1;
                 }
+
+                visited[w] = 0;
+            }
+        }
+
+        // Adjacency accessors for the traversal helpers.
+        struct follow_predecessors
+        {
+            template<typename T>
+            auto operator()(dag<T> const &graph, typename dag<T>::index_type i) const
+            {
+                return graph.get_predecessors(i);
+            }
+        };
+
+        struct follow_successors
+        {
+            template<typename T>
+            auto operator()(dag<T> const &graph, typename dag<T>::index_type i) const
+            {
+                return graph.get_successors(i);
+            }
+        };
+    }
+
+    // Given a dag and a node, what nodes can reach this node?
+    // output will be sorted by node id.
+    template<typename T>
+    bool find_all_before(
+            dag<T> const &graph,
+            T node_id,
+            traversal_workspace<T> &workspace,
+            typename dag<T>::node_id_vector &out)
+    {
+        out.clear();
+
+        // Ensure the graph is valid.  We don't actually care if it
+        // contains this node.   
+        if(graph.get_valid())
+        {
+            auto index = graph.index_of(node_id);
+
+            if(index != dag<T>::invalid_index)
+            {
+                workspace.reserve(graph);
+
+                // Depth first back up the graph.
+                detail::mark_reachable(
+                    graph,
+                    index,
+                    detail::follow_predecessors(),
+                    workspace.get_visited(),
+                    workspace.get_to_process());
+
+                detail::gather_marked(graph, workspace.get_visited(), out);
             }
             return true;
         }
@@ -145,6 +290,20 @@ namespace s3d_graph
             return false;
         }
     }
+
+    // As above with a temporary workspace.  Allocating and clearing its
+    // bitsets is O(V) on every call, however few nodes the search reaches,
+    // so keep a workspace for repeated queries on a large graph.
+    template<typename T>
+    bool find_all_before(
+            dag<T> const &graph,
+            T node_id,
+            typename dag<T>::node_id_vector &out)
+    {
+        traversal_workspace<T> workspace;
+
+        return find_all_before(graph, node_id, workspace, out);
+    }
  
     // Given a dag and a node, what nodes can be reached from this node?
     // output will be sorted by node id.
@@ -152,52 +311,30 @@ namespace s3d_graph
     bool find_all_after(
             dag<T> const &graph,
             T node_id,
+            traversal_workspace<T> &workspace,
             typename dag<T>::node_id_vector &out)
     {
-        using node_id_vector    = typename dag<T>::node_id_vector;
-
         out.clear();
 
         // Ensure the graph is valid.  We don't actually care if it
         // contains this node.   
         if(graph.get_valid())
         {
-            node_id_vector to_process;
-            auto &edges = graph.get_edges_by_src();
+            auto index = graph.index_of(node_id);
 
-            to_process.push_back(node_id);
-
-            // Depth first down the graph.
-            while(!to_process.empty())
+            if(index != dag<T>::invalid_index)
             {
-                auto cur_id = to_process.back();
-                to_process.pop_back();
-
-                // Find all edges that point from this node.
-                auto edge_it = std::lower_bound(
-                    edges.begin(),
-                    edges.end(),
-                    cur_id,
-                    [](auto &e, auto &n) { return e.get_src() < n; });
+                workspace.reserve(graph);
 
-                while((edge_it != edges.end()) && 
-                      (edge_it->get_src() == cur_id))
-                {
-                    // Find insertion point in output.
-                    auto ins_it = std::lower_bound(
-                        out.begin(),
-                        out.end(),
-                        edge_it->get_dst());
-
-                    if((ins_it == out.end()) ||
-                       (edge_it->get_dst() != *ins_it))
-                    {
-                        out.insert(ins_it, edge_it->get_dst());
-                        to_process.push_back(edge_it->get_dst());
-                    }
+                // Depth first down the graph.
+                detail::mark_reachable(
+                    graph,
+                    index,
+                    detail::follow_successors(),
+                    workspace.get_visited(),
+                    workspace.get_to_process());
 
-                    ++edge_it;
-                }
+                detail::gather_marked(graph, workspace.get_visited(), out);
             }
             return true;
         }
@@ -207,6 +344,20 @@ namespace s3d_graph
         }
     } 
 
+    // As above with a temporary workspace.  Allocating and clearing its
+    // bitsets is O(V) on every call, however few nodes the search reaches,
+    // so keep a workspace for repeated queries on a large graph.
+    template<typename T>
+    bool find_all_after(
+            dag<T> const &graph,
+            T node_id,
+            typename dag<T>::node_id_vector &out)
+    {
+        traversal_workspace<T> workspace;
+
+        return find_all_after(graph, node_id, workspace, out);
+    }
+
     // Given a DAG used in a scheduler, what could potentially run at the same 
     // time as this?
     // output will be sorted by node id.
@@ -214,46 +365,64 @@ namespace s3d_graph
     bool find_all_siblings(
             dag<T> const &graph,
             T node_id,
+            traversal_workspace<T> &workspace,
             typename dag<T>::node_id_vector &out)
     {
-        using node_id_vector = typename dag<T>::node_id_vector;
+        using index_type = typename dag<T>::index_type;
 
         out.clear();
 
+        auto index = graph.index_of(node_id);
+
         // Ensure graph is valid and contains the node.
-        if(graph.get_valid() &&
-           std::binary_search(graph.get_all_nodes().begin(),
-                              graph.get_all_nodes().end(),
-                              node_id))
+        if(graph.get_valid() && (index != dag<T>::invalid_index))
         {
-            // Find everything before and after this node.
-            node_id_vector before, after;
+            workspace.reserve(graph);
+
+            auto &before = workspace.get_visited();
+            auto &after = workspace.get_marked();
+
+            // Mark everything before and after this node, along with the
+            // input.
+            detail::mark_reachable(
+                graph,
+                index,
+                detail::follow_predecessors(),
+                before,
+                workspace.get_to_process());
+
+            detail::mark_reachable(
+                graph,
+                index,
+                detail::follow_successors(),
+                after,
+                workspace.get_to_process());
+
+            before[index / 64] |= std::uint64_t(1) << (index % 64);
+
+            // Anything unmarked is a sibling.
+            auto node_count = graph.get_node_count();
+            auto word_count = (node_count + 63) / 64;
+
+            for(size_t w = 0; w < word_count; ++w)
+            {
+                auto word = ~(before[w] | after[w]);
+
+                // Ignore bits past the last node.
+                if((w + 1 == word_count) && (node_count % 64 != 0))
+                {
+                    word &= (std::uint64_t(1) << (node_count % 64)) - 1;
+                }
 
-            find_all_before(graph, node_id, before);
-            find_all_after(graph, node_id, after);
+                while(word != 0)
+                {
+                    auto bit = detail::lowest_bit(word);
+                    out.emplace_back(graph.id_of(index_type(w * 64 + bit)));
+                    word &= word - 1;
+                }
 
-            // fast out for case when there are no siblings.
-            if((before.size() + after.size() + 1) < 
-               graph.get_all_nodes().size())
-            {
-                out = graph.get_all_nodes();
-
-                // Remove everything in the before & after vectors, along
-                // with the input.
-                out.erase(
-                    std::remove_if(
-                        out.begin(),
-                        out.end(),
-                        [&before, &after, node_id](auto n)
-                        {
-                            return 
-                                (n == node_id) ||
-                                std::binary_search(
-                                    before.begin(), before.end(), n) ||
-                                std::binary_search(
-                                    after.begin(), after.end(), n);
-                        }),
-                        out.end());
+                before[w] = 0;
+                after[w] = 0;
             }
             return true;
         }
@@ -263,72 +432,267 @@ namespace s3d_graph
         }
     }
 
+    // As above with a temporary workspace.  Allocating and clearing its
+    // bitsets is O(V) on every call, however few nodes the search reaches,
+    // so keep a workspace for repeated queries on a large graph.
+    template<typename T>
+    bool find_all_siblings(
+            dag<T> const &graph,
+            T node_id,
+            typename dag<T>::node_id_vector &out)
+    {
+        traversal_workspace<T> workspace;
+
+        return find_all_siblings(graph, node_id, workspace, out);
+    }
+
+    // Is there a path from src to dst?  A node doesn't reach itself, and
+    // false if either node isn't in the graph.
+    //
+    // Searches forwards from src and backwards from dst at once, always
+    // growing the smaller frontier, and stops as soon as they meet.  Every
+    // edge raises the topological rank, so the forward search skips nodes
+    // ranked at or after dst and the backward one nodes ranked at or
+    // before src.
+    template<typename T>
+    bool is_reachable(
+            dag<T> const &graph,
+            T src,
+            T dst,
+            traversal_workspace<T> &workspace)
+    {
+        auto src_index = graph.index_of(src);
+        auto dst_index = graph.index_of(dst);
+
+        if(!graph.get_valid() ||
+           (src_index == dag<T>::invalid_index) ||
+           (dst_index == dag<T>::invalid_index) ||
+           (graph.get_rank(src_index) >= graph.get_rank(dst_index)))
+        {
+            return false;
+        }
+
+        workspace.reserve(graph);
+
+        auto &after = workspace.get_visited();
+        auto &before = workspace.get_marked();
+        auto &forward = workspace.get_to_process();
+        auto &backward = workspace.get_reverse_to_process();
+
+        auto src_rank = graph.get_rank(src_index);
+        auto dst_rank = graph.get_rank(dst_index);
+
+        auto test_bit = [](std::vector<std::uint64_t> const &bits, size_t i)
+        {
+            return ((bits[i / 64] >> (i % 64)) & 1) != 0;
+        };
+
+        auto set_bit = [](std::vector<std::uint64_t> &bits, size_t i)
+        {
+            bits[i / 64] |= std::uint64_t(1) << (i % 64);
+        };
+
+        forward.assign(1, src_index);
+        backward.assign(1, dst_index);
+        set_bit(after, src_index);
+        set_bit(before, dst_index);
+
+        size_t forward_head = 0, backward_head = 0;
+        bool found = false;
+
+        while(!found &&
+              (forward_head != forward.size()) &&
+              (backward_head != backward.size()))
+        {
+            if(forward.size() - forward_head <= backward.size() - backward_head)
+            {
+                // One layer forwards.
+                for(auto end = forward.size(); !found && (forward_head != end); ++forward_head)
+                {
+                    for(auto next : graph.get_successors(forward[forward_head]))
+                    {
+                        if(test_bit(before, next))
+                        {
+                            found = true;
+                            break;
+                        }
+
+                        if((graph.get_rank(next) < dst_rank) && !test_bit(after, next))
+                        {
+                            set_bit(after, next);
+                            forward.push_back(next);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                // One layer backwards.
+                for(auto end = backward.size(); !found && (backward_head != end); ++backward_head)
+                {
+                    for(auto next : graph.get_predecessors(backward[backward_head]))
+                    {
+                        if(test_bit(after, next))
+                        {
+                            found = true;
+                            break;
+                        }
+
+                        if((graph.get_rank(next) > src_rank) && !test_bit(before, next))
+                        {
+                            set_bit(before, next);
+                            backward.push_back(next);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Every marked node is still listed, so only their words need
+        // clearing.
+        for(auto index : forward)
+        {
+            after[index / 64] = 0;
+        }
+
+        for(auto index : backward)
+        {
+            before[index / 64] = 0;
+        }
+
+        forward.clear();
+        backward.clear();
+        return found;
+    }
+
+    // As above with a temporary workspace, which costs O(V) to allocate
+    // and clear on every call that gets as far as searching.  Keep a
+    // workspace for repeated queries on a large graph.
+    template<typename T>
+    bool is_reachable(dag<T> const &graph, T src, T dst)
+    {
+        traversal_workspace<T> workspace;
+
+        return is_reachable(graph, src, dst, workspace);
+    }
+
+    // Would adding an edge from src to dst make the graph cyclic?  That is
+    // when src is dst, or dst already reaches src.  Nodes not yet in the
+    // graph can't close a cycle.  An invalid graph already has a cycle, so
+    // gives true.
+    template<typename T>
+    bool would_create_cycle(
+            dag<T> const &graph,
+            T src,
+            T dst,
+            traversal_workspace<T> &workspace)
+    {
+        return
+            !graph.get_valid() ||
+            (src == dst) ||
+            is_reachable(graph, dst, src, workspace);
+    }
+
+    // As above with a temporary workspace.  See is_reachable for its
+    // cost.
+    template<typename T>
+    bool would_create_cycle(dag<T> const &graph, T src, T dst)
+    {
+        traversal_workspace<T> workspace;
+
+        return would_create_cycle(graph, src, dst, workspace);
+    }
+
 
     // This assumes you are using the DAG for some sort of scheduling operation
     //
     // Finds tasks that could be scheduled now given a set of completed tasks.
-    // "done" vector must be sorted, as it is being used as a set.
+    // "done" vector is used as a set, so its order doesn't matter.
+    // output will be sorted by node id.
+    //
+    // Only edges leaving the done set are visited: each one bumps a count
+    // on its destination, which is ready once the count matches its
+    // in-degree.  So the cost is proportional to the done set's out-edges
+    // plus the graph's roots, not to the whole graph, provided the same
+    // workspace is passed to every call.  The workspace is left cleared,
+    // so sizing it is the only O(V) cost, paid once.
     template<typename T>
     bool find_current_tasks(
             dag<T> const &graph,
             typename dag<T>::node_id_vector const &done,
+            traversal_workspace<T> &workspace,
             typename dag<T>::node_id_vector &out)
     {
+        using index_type = typename dag<T>::index_type;
+
         out.clear();
 
         if(graph.get_valid())
         {
-            out = graph.get_all_nodes();
-            auto edges = graph.get_edges_by_dst();
-
-            // erase all nodes in the "done" set.
-            out.erase(
-                std::remove_if(
-                    out.begin(),
-                    out.end(),
-                    [&done](auto &n)
-                    {
-                        return std::binary_search(
-                            done.begin(),
-                            done.end(),
-                            n);
-                    }),
-                out.end());
-
-            // erase all edges coming from the done set.
-            edges.erase(
-                std::remove_if(
-                    edges.begin(),
-                    edges.end(),
-                    [&done](auto &e)
-                    {
-                        return std::binary_search(
-                            done.begin(),
-                            done.end(),
-                            e.get_src());
-                    }),
-                edges.end());
-
-            // erase all nodes pointed to by remaining edges.
-            out.erase(
-                std::remove_if(
-                    out.begin(),
-                    out.end(),
-                    [&edges](auto &id)->bool
+            workspace.reserve_counts(graph);
+
+            auto &done_set = workspace.get_visited();
+            auto &counts = workspace.get_counts();
+            auto &candidates = workspace.get_to_process();
+
+            auto is_done = [&done_set](index_type index)
+            {
+                return ((done_set[index / 64] >> (index % 64)) & 1) != 0;
+            };
+
+            candidates.clear();
+
+            // Count edges from done tasks into each task they lead to.
+            for(auto id : done)
+            {
+                auto index = graph.index_of(id);
+
+                if((index != dag<T>::invalid_index) && !is_done(index))
+                {
+                    done_set[index / 64] |= std::uint64_t(1) << (index % 64);
+
+                    for(auto dst : graph.get_successors(index))
                     {
-                        auto e_it = std::lower_bound(
-                            edges.begin(),
-                            edges.end(),
-                            id,
-                            [](auto &e, auto &dst_id)->bool
-                            {
-                                return e.get_dst() < dst_id;
-                            });
-
-                        return  (e_it != edges.end()) &&
-                                (e_it->get_dst() == id);
-                    }),
-                out.end());                     
+                        if(counts[dst]++ == 0)
+                        {
+                            candidates.push_back(dst);
+                        }
+                    }
+                }
+            }
+
+            // A task can run if it isn't done but everything before it is.
+            for(auto index : candidates)
+            {
+                if(!is_done(index) &&
+                   (counts[index] == graph.get_predecessors(index).size()))
+                {
+                    out.emplace_back(graph.id_of(index));
+                }
+
+                counts[index] = 0;
+            }
+
+            // Roots have nothing before them.
+            for(auto index : graph.get_root_indices())
+            {
+                if(!is_done(index))
+                {
+                    out.emplace_back(graph.id_of(index));
+                }
+            }
+
+            std::sort(out.begin(), out.end());
+
+            for(auto id : done)
+            {
+                auto index = graph.index_of(id);
+
+                if(index != dag<T>::invalid_index)
+                {
+                    done_set[index / 64] = 0;
+                }
+            }
 
             return true;
         }
@@ -337,6 +701,20 @@ namespace s3d_graph
             return false;
         }
     }
+
+    // As above with a temporary workspace.  Allocating and clearing that
+    // is O(V) on every call, so a scheduler calling this repeatedly should
+    // keep a workspace and use the overload above.
+    template<typename T>
+    bool find_current_tasks(
+            dag<T> const &graph,
+            typename dag<T>::node_id_vector const &done,
+            typename dag<T>::node_id_vector &out)
+    {
+        traversal_workspace<T> workspace;
+
+        return find_current_tasks(graph, done, workspace, out);
+    }
 }
 
 #endif
@@ -0,0 +1,1460 @@
+#include "dag.h"
+#include "algorithms.h"
+#include "concurrent_dag.h"
+#include "reachability.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace s3d_graph;
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    // Run fn and return how long it took in milliseconds.
+    template<typename Fn>
+    double time_ms(Fn &&fn)
+    {
+        auto start = clock_type::now();
+        fn();
+        auto end = clock_type::now();
+
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // Make a random DAG.  Edges always point from a lower to a higher
+    // position in a hidden random order, and ids are shuffled so that
+    // neither the id order nor the edge order gives the answer away.
+    template<typename NodeID>
+    std::vector<directed_edge<NodeID>> make_random_dag(
+            size_t node_count,
+            size_t edge_count,
+            uint64_t seed)
+    {
+        std::mt19937_64 rng(seed);
+        std::vector<NodeID> ids(node_count);
+
+        std::iota(ids.begin(), ids.end(), NodeID(0));
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        std::uniform_int_distribution<size_t> pick(0, node_count - 1);
+        std::vector<directed_edge<NodeID>> edges;
+
+        edges.reserve(edge_count);
+
+        while(edges.size() < edge_count)
+        {
+            auto a = pick(rng), b = pick(rng);
+
+            if(a != b)
+            {
+                edges.emplace_back(ids[std::min(a, b)], ids[std::max(a, b)]);
+            }
+        }
+
+        return edges;
+    }
+
+    // Make a deep, narrow random DAG, like a long build.  A chain through
+    // the hidden order makes its first node the only root, reaching
+    // everything, and the remaining edges only span a few positions.
+    template<typename NodeID>
+    std::vector<directed_edge<NodeID>> make_deep_dag(
+            size_t node_count,
+            size_t edge_count,
+            uint64_t seed)
+    {
+        std::mt19937_64 rng(seed);
+        std::vector<NodeID> ids(node_count);
+
+        std::iota(ids.begin(), ids.end(), NodeID(0));
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        std::uniform_int_distribution<size_t> pick(0, node_count - 1);
+        std::uniform_int_distribution<size_t> span(2, 8);
+        std::vector<directed_edge<NodeID>> edges;
+
+        edges.reserve(edge_count);
+
+        for(size_t i = 1; (i < node_count) && (edges.size() < edge_count); ++i)
+        {
+            edges.emplace_back(ids[i - 1], ids[i]);
+        }
+
+        while(edges.size() < edge_count)
+        {
+            auto a = pick(rng), b = a + span(rng);
+
+            if(b < node_count)
+            {
+                edges.emplace_back(ids[a], ids[b]);
+            }
+        }
+
+        return edges;
+    }
+
+    // Make a wide, shallow random DAG.  Nodes are split into level_count
+    // layers and every edge goes from one layer to the next.
+    template<typename NodeID>
+    std::vector<directed_edge<NodeID>> make_wide_dag(
+            size_t node_count,
+            size_t edge_count,
+            size_t level_count,
+            uint64_t seed)
+    {
+        std::mt19937_64 rng(seed);
+        std::vector<NodeID> ids(node_count);
+
+        std::iota(ids.begin(), ids.end(), NodeID(0));
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        size_t width = node_count / level_count;
+
+        std::uniform_int_distribution<size_t> pick_level(0, level_count - 2);
+        std::uniform_int_distribution<size_t> pick(0, width - 1);
+        std::vector<directed_edge<NodeID>> edges;
+
+        edges.reserve(edge_count);
+
+        while(edges.size() < edge_count)
+        {
+            auto level = pick_level(rng);
+
+            edges.emplace_back(
+                ids[level * width + pick(rng)],
+                ids[(level + 1) * width + pick(rng)]);
+        }
+
+        return edges;
+    }
+
+    // Spread small ids over the whole 64 bit range, like hashed names.
+    uint64_t mix_id(uint64_t id)
+    {
+        id += 0x9e3779b97f4a7c15ull;
+        id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ull;
+        id = (id ^ (id >> 27)) * 0x94d049bb133111ebull;
+        return id ^ (id >> 31);
+    }
+
+    std::vector<directed_edge<uint64_t>> make_hashed_dag(
+            size_t node_count,
+            size_t edge_count,
+            uint64_t seed)
+    {
+        auto edges = make_random_dag<uint64_t>(node_count, edge_count, seed);
+
+        for(auto &edge : edges)
+        {
+            edge = directed_edge<uint64_t>(
+                mix_id(edge.get_src()), mix_id(edge.get_dst()));
+        }
+
+        return edges;
+    }
+
+    // The original topological sort, which binary searches the edge
+    // vectors and in-degree records for every edge.  Kept as a baseline.
+    template<typename NodeID>
+    size_t legacy_topological_sort(
+            std::vector<directed_edge<NodeID>> const &edges_by_src,
+            std::vector<directed_edge<NodeID>> const &edges_by_dst,
+            std::vector<NodeID> const &all_nodes,
+            std::vector<NodeID> &sorted_nodes)
+    {
+        using count_record = std::pair<NodeID, size_t>;
+
+        std::vector<count_record> incoming_counts;
+
+        sorted_nodes.clear();
+
+        for(auto id : all_nodes)
+        {
+            incoming_counts.emplace_back(id, size_t(0));
+        }
+
+        auto find_count = [&incoming_counts](NodeID id) -> count_record &
+        {
+            return *std::lower_bound(
+                incoming_counts.begin(),
+                incoming_counts.end(),
+                id,
+                [](auto &count, auto &n) { return count.first < n; });
+        };
+
+        auto push_edges_from = [&edges_by_src](NodeID id, std::queue<NodeID> &q)
+        {
+            auto it = std::lower_bound(
+                edges_by_src.begin(),
+                edges_by_src.end(),
+                id,
+                [](auto &edge, auto &n) { return edge.get_src() < n; });
+
+            for(; (it != edges_by_src.end()) && (it->get_src() == id); ++it)
+            {
+                q.push(it->get_dst());
+            }
+        };
+
+        for(auto &edge : edges_by_dst)
+        {
+            ++find_count(edge.get_dst()).second;
+        }
+
+        std::queue<NodeID> to_process;
+
+        for(auto &count : incoming_counts)
+        {
+            if(count.second == 0)
+            {
+                sorted_nodes.push_back(count.first);
+                push_edges_from(count.first, to_process);
+            }
+        }
+
+        while(!to_process.empty())
+        {
+            auto id = to_process.front();
+            to_process.pop();
+
+            if(--find_count(id).second == 0)
+            {
+                sorted_nodes.push_back(id);
+                push_edges_from(id, to_process);
+            }
+        }
+
+        return sorted_nodes.size();
+    }
+
+    // The original dag construction: two sorted copies of the edges, a
+    // sorted node list and the legacy topological sort.
+    template<typename NodeID>
+    size_t legacy_build(std::vector<directed_edge<NodeID>> const &edges)
+    {
+        auto edges_by_src = edges, edges_by_dst = edges;
+
+        std::sort(
+            edges_by_src.begin(),
+            edges_by_src.end(),
+            [](auto &a, auto &b){return a.get_src() < b.get_src();});
+
+        std::sort(
+            edges_by_dst.begin(),
+            edges_by_dst.end(),
+            [](auto &a, auto &b){return a.get_dst() < b.get_dst();});
+
+        std::vector<NodeID> all_nodes, sorted_nodes;
+
+        for(auto &edge : edges_by_src)
+        {
+            all_nodes.push_back(edge.get_src());
+            all_nodes.push_back(edge.get_dst());
+        }
+
+        std::sort(all_nodes.begin(), all_nodes.end());
+        all_nodes.erase(
+            std::unique(all_nodes.begin(), all_nodes.end()),
+            all_nodes.end());
+
+        return legacy_topological_sort(
+            edges_by_src, edges_by_dst, all_nodes, sorted_nodes);
+    }
+
+    void bench_topological_sort()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("topological_sort: legacy construction vs dag construction\n");
+        printf("%12s %12s %16s %16s\n",
+               "edges", "nodes", "legacy ms", "dag ms");
+
+        for(size_t edge_count : {size_t(1000000), size_t(10000000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            auto edges = make_random_dag<uint32_t>(node_count, edge_count, 1);
+
+            size_t legacy_sorted = 0;
+            std::unique_ptr<dag_type> graph;
+
+            double legacy_ms = time_ms(
+                [&] { legacy_sorted = legacy_build(edges); });
+
+            double dag_ms = time_ms(
+                [&] { graph.reset(new dag_type(edges.begin(), edges.end())); });
+
+            if(legacy_sorted != graph->get_sorted_nodes().size())
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph->get_all_nodes().size(),
+                   legacy_ms,
+                   dag_ms);
+        }
+    }
+
+    template<typename NodeID>
+    void bench_sort_edges(
+            char const *label,
+            std::vector<directed_edge<NodeID>> const &edges)
+    {
+        auto by_src = [](auto &edge){return edge.get_src();};
+
+        auto radix_edges = edges;
+        auto comparison_edges = edges;
+
+        double radix_ms = time_ms(
+            [&]
+            {
+                detail::radix_sort_by_key(
+                    radix_edges.begin(), radix_edges.end(), by_src);
+            });
+
+        double comparison_ms = time_ms(
+            [&]
+            {
+                detail::comparison_sort_by_key(
+                    comparison_edges.begin(), comparison_edges.end(), by_src);
+            });
+
+        printf("%-18s %12zu %16.1f %16.1f\n",
+               label,
+               edges.size(),
+               comparison_ms,
+               radix_ms);
+    }
+
+    void bench_sort()
+    {
+        printf("sort: comparison vs radix sort of edges by src\n");
+        printf("%-18s %12s %16s %16s\n",
+               "ids", "edges", "comparison ms", "radix ms");
+
+        for(size_t edge_count : {size_t(1000000), size_t(10000000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            bench_sort_edges(
+                "32 bit dense",
+                make_random_dag<uint32_t>(node_count, edge_count, 2));
+
+            bench_sort_edges(
+                "64 bit hashed",
+                make_hashed_dag(node_count, edge_count, 2));
+        }
+    }
+
+    // The original find_all_after, which keeps the output as a sorted
+    // vector and inserts into it as nodes are reached.
+    template<typename NodeID>
+    void legacy_find_all_after(
+            dag<NodeID> const &graph,
+            NodeID node_id,
+            std::vector<NodeID> &out)
+    {
+        auto &edges = graph.get_edges_by_src();
+        std::vector<NodeID> to_process;
+
+        out.clear();
+        to_process.push_back(node_id);
+
+        while(!to_process.empty())
+        {
+            auto cur_id = to_process.back();
+            to_process.pop_back();
+
+            auto edge_it = std::lower_bound(
+                edges.begin(),
+                edges.end(),
+                cur_id,
+                [](auto &e, auto &n) { return e.get_src() < n; });
+
+            for(; (edge_it != edges.end()) && (edge_it->get_src() == cur_id); ++edge_it)
+            {
+                auto ins_it = std::lower_bound(out.begin(), out.end(), edge_it->get_dst());
+
+                if((ins_it == out.end()) || (edge_it->get_dst() != *ins_it))
+                {
+                    out.insert(ins_it, edge_it->get_dst());
+                    to_process.push_back(edge_it->get_dst());
+                }
+            }
+        }
+    }
+
+    void bench_find_all_after()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("find_all_after: sorted insertion vs visited bitset, deep graph\n");
+        printf("%12s %12s %12s %16s %16s\n",
+               "edges", "nodes", "reached", "legacy ms", "bitset ms");
+
+        for(size_t edge_count : {size_t(100000), size_t(1000000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            auto edges = make_deep_dag<uint32_t>(node_count, edge_count, 3);
+            dag_type graph(edges.begin(), edges.end());
+
+            auto root = graph.get_sorted_nodes().front();
+            std::vector<uint32_t> legacy_out, out;
+
+            double legacy_ms = time_ms(
+                [&] { legacy_find_all_after(graph, root, legacy_out); });
+
+            double bitset_ms = time_ms(
+                [&] { find_all_after(graph, root, out); });
+
+            if(legacy_out != out)
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_all_nodes().size(),
+                   out.size(),
+                   legacy_ms,
+                   bitset_ms);
+        }
+    }
+
+    // Complete every task in graph on thread_count threads, with
+    // mark_done(id, newly_ready) called for each.  Released tasks are
+    // appended to a shared array that the threads consume in order, so
+    // nearly all the time goes on completing tasks.
+    template<typename NodeID, typename MarkDone>
+    void complete_all(
+            dag<NodeID> const &graph,
+            unsigned thread_count,
+            MarkDone &&mark_done)
+    {
+        auto node_count = graph.get_all_nodes().size();
+        std::unique_ptr<std::atomic<bool>[]> published(
+            new std::atomic<bool>[node_count]);
+        std::vector<NodeID> ready_ids(node_count);
+        std::atomic<size_t> head(0), tail(0);
+
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            published[i] = false;
+        }
+
+        auto release = [&](NodeID id)
+        {
+            auto slot = tail++;
+            ready_ids[slot] = id;
+            published[slot].store(true, std::memory_order_release);
+        };
+
+        for(auto index : graph.get_root_indices())
+        {
+            release(graph.id_of(index));
+        }
+
+        std::vector<std::thread> threads;
+
+        for(unsigned t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    std::vector<NodeID> newly_ready;
+
+                    for(size_t slot = head++; slot < node_count; slot = head++)
+                    {
+                        while(!published[slot].load(std::memory_order_acquire))
+                        {
+                            std::this_thread::yield();
+                        }
+
+                        mark_done(ready_ids[slot], newly_ready);
+
+                        for(auto id : newly_ready)
+                        {
+                            release(id);
+                        }
+                    }
+                });
+        }
+
+        for(auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    void bench_ready_tracker()
+    {
+        using dag_type = dag<uint32_t>;
+
+        size_t edge_count = 4000000, node_count = edge_count / 4;
+
+        auto edges = make_random_dag<uint32_t>(node_count, edge_count, 4);
+        dag_type graph(edges.begin(), edges.end());
+
+        printf("ready_tracker: completing %zu tasks, %zu edges\n",
+               graph.get_all_nodes().size(), edge_count);
+        printf("%12s %16s %16s\n",
+               "threads", "locked ms", "atomic ms");
+
+        for(unsigned thread_count : {1u, 2u, 4u, 8u, 16u})
+        {
+            ready_tracker<uint32_t> locked(graph);
+            concurrent_ready_tracker<uint32_t> atomic(graph);
+            std::mutex mutex;
+
+            double locked_ms = time_ms(
+                [&]
+                {
+                    complete_all(
+                        graph,
+                        thread_count,
+                        [&](uint32_t id, std::vector<uint32_t> &newly_ready)
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            locked.mark_done(id, newly_ready);
+                        });
+                });
+
+            double atomic_ms = time_ms(
+                [&]
+                {
+                    complete_all(
+                        graph,
+                        thread_count,
+                        [&](uint32_t id, std::vector<uint32_t> &newly_ready)
+                        {
+                            atomic.mark_done(id, newly_ready);
+                        });
+                });
+
+            if(!locked.get_finished() || !atomic.get_finished())
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12u %16.1f %16.1f\n",
+                   thread_count,
+                   locked_ms,
+                   atomic_ms);
+        }
+    }
+
+    template<typename NodeID>
+    void bench_level_sort_graph(
+            char const *label,
+            std::vector<directed_edge<NodeID>> const &edges)
+    {
+        using dag_type = dag<NodeID>;
+
+        // Build once, then time only the ordering step.
+        dag_type graph(edges.begin(), edges.end());
+
+        for(unsigned thread_count : {1u, 2u, 4u, 8u, 16u, 32u, 64u})
+        {
+            dag_options options;
+            options.thread_count = thread_count;
+
+            double kahn_ms = time_ms([&] { graph.resort(options); });
+            auto kahn_order = graph.get_sorted_nodes().size();
+
+            options.order = topological_order::level_major;
+
+            double level_ms = time_ms([&] { graph.resort(options); });
+
+            if(kahn_order != graph.get_sorted_nodes().size())
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%-8s %12zu %12zu %8u %16.1f %16.1f\n",
+                   label,
+                   edges.size(),
+                   graph.get_all_nodes().size(),
+                   thread_count,
+                   kahn_ms,
+                   level_ms);
+        }
+    }
+
+    void bench_level_sort()
+    {
+        printf("level_sort: ordering a built graph with kahn vs level-major order\n");
+        printf("%-8s %12s %12s %8s %16s %16s\n",
+               "graph", "edges", "nodes", "threads", "kahn ms", "level ms");
+
+        size_t edge_count = 4000000, node_count = edge_count / 4;
+
+        bench_level_sort_graph(
+            "wide",
+            make_wide_dag<uint32_t>(node_count, edge_count, 8, 5));
+
+        bench_level_sort_graph(
+            "deep",
+            make_deep_dag<uint32_t>(node_count, edge_count, 5));
+    }
+
+    void bench_closure()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("closure: find_all_siblings by traversal vs transitive closure\n");
+        printf("%12s %12s %12s %12s %16s %16s\n",
+               "edges", "nodes", "closure MB", "build ms", "traversal ms", "closure ms");
+
+        for(size_t edge_count : {size_t(40000), size_t(200000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            auto edges = make_deep_dag<uint32_t>(node_count, edge_count, 6);
+            dag_type graph(edges.begin(), edges.end());
+
+            std::unique_ptr<transitive_closure<uint32_t>> closure;
+
+            double build_ms = time_ms(
+                [&] { closure.reset(new transitive_closure<uint32_t>(graph)); });
+
+            // Query a spread of nodes, each both ways.
+            auto &nodes = graph.get_all_nodes();
+            std::vector<uint32_t> out, closure_out;
+            traversal_workspace<uint32_t> workspace(graph);
+            size_t mismatches = 0;
+
+            double traversal_ms = 0, closure_ms = 0;
+
+            for(size_t i = 0; i < nodes.size(); i += nodes.size() / 200)
+            {
+                traversal_ms += time_ms(
+                    [&] { find_all_siblings(graph, nodes[i], workspace, out); });
+
+                closure_ms += time_ms(
+                    [&] { closure->find_all_siblings(nodes[i], closure_out); });
+
+                mismatches += (out != closure_out);
+            }
+
+            if(mismatches != 0)
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %12.1f %12.1f %16.1f %16.1f\n",
+                   edge_count,
+                   nodes.size(),
+                   closure->get_memory_size() / (1024.0 * 1024.0),
+                   build_ms,
+                   traversal_ms,
+                   closure_ms);
+        }
+    }
+
+    // Depth first search from src for dst, with no index.
+    bool dfs_is_reachable(
+            dag<uint32_t> const &graph,
+            uint32_t src,
+            uint32_t dst,
+            std::vector<uint8_t> &visited,
+            std::vector<uint32_t> &touched)
+    {
+        bool found = false;
+        std::vector<uint32_t> stack(1, src);
+
+        while(!stack.empty() && !found)
+        {
+            auto index = stack.back();
+            stack.pop_back();
+
+            for(auto next : graph.get_successors(index))
+            {
+                if(next == dst)
+                {
+                    found = true;
+                    break;
+                }
+
+                if(!visited[next])
+                {
+                    visited[next] = 1;
+                    touched.push_back(next);
+                    stack.push_back(next);
+                }
+            }
+        }
+
+        for(auto index : touched)
+        {
+            visited[index] = 0;
+        }
+
+        touched.clear();
+        return found;
+    }
+
+    void bench_interval_index()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("interval_index: random is_reachable queries, DFS vs interval labels\n");
+        printf("%12s %12s %12s %12s %12s %16s %16s\n",
+               "edges", "nodes", "labels MB", "build ms", "reachable",
+               "dfs ms", "interval ms");
+
+        for(size_t edge_count : {size_t(1000000), size_t(20000000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            auto edges = make_random_dag<uint32_t>(node_count, edge_count, 7);
+            dag_type graph(edges.begin(), edges.end());
+
+            std::unique_ptr<interval_index<uint32_t>> index;
+
+            double build_ms = time_ms(
+                [&] { index.reset(new interval_index<uint32_t>(graph, 3, 3)); });
+
+            std::mt19937_64 rng(8);
+            std::uniform_int_distribution<uint32_t> pick(
+                0, uint32_t(graph.get_all_nodes().size() - 1));
+            std::vector<std::pair<uint32_t, uint32_t>> queries(1000);
+
+            for(auto &q : queries)
+            {
+                q = std::make_pair(pick(rng), pick(rng));
+            }
+
+            std::vector<uint8_t> visited(graph.get_all_nodes().size(), 0);
+            std::vector<uint32_t> touched;
+            traversal_workspace<uint32_t> workspace(graph);
+            size_t dfs_reachable = 0, interval_reachable = 0;
+
+            double dfs_ms = time_ms(
+                [&]
+                {
+                    for(auto &q : queries)
+                    {
+                        dfs_reachable += dfs_is_reachable(
+                            graph, q.first, q.second, visited, touched);
+                    }
+                });
+
+            double interval_ms = time_ms(
+                [&]
+                {
+                    for(auto &q : queries)
+                    {
+                        interval_reachable += index->is_reachable_index(
+                            q.first, q.second, workspace);
+                    }
+                });
+
+            if(dfs_reachable != interval_reachable)
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %12.1f %12.1f %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_all_nodes().size(),
+                   index->get_memory_size() / (1024.0 * 1024.0),
+                   build_ms,
+                   dfs_reachable,
+                   dfs_ms,
+                   interval_ms);
+        }
+    }
+
+    template<typename NodeID>
+    void bench_is_reachable_graph(
+            char const *label,
+            std::vector<directed_edge<NodeID>> const &edges)
+    {
+        dag<NodeID> graph(edges.begin(), edges.end());
+
+        auto &nodes = graph.get_all_nodes();
+        std::mt19937_64 rng(9);
+        std::uniform_int_distribution<size_t> pick(0, nodes.size() - 1);
+        std::vector<NodeID> after;
+        traversal_workspace<NodeID> workspace(graph);
+        size_t enumerated = 0, searched = 0, query_count = 200;
+
+        std::vector<std::pair<NodeID, NodeID>> queries(query_count);
+
+        for(auto &q : queries)
+        {
+            q = std::make_pair(nodes[pick(rng)], nodes[pick(rng)]);
+        }
+
+        double after_ms = time_ms(
+            [&]
+            {
+                for(auto &q : queries)
+                {
+                    find_all_after(graph, q.first, workspace, after);
+                    enumerated += std::binary_search(
+                        after.begin(), after.end(), q.second);
+                }
+            });
+
+        double reachable_ms = time_ms(
+            [&]
+            {
+                for(auto &q : queries)
+                {
+                    searched += is_reachable(graph, q.first, q.second, workspace);
+                }
+            });
+
+        if(enumerated != searched)
+        {
+            printf("mismatched results!\n");
+        }
+
+        printf("%-8s %12zu %12zu %12zu %16.1f %16.1f\n",
+               label,
+               edges.size(),
+               nodes.size(),
+               searched,
+               after_ms,
+               reachable_ms);
+    }
+
+    void bench_is_reachable()
+    {
+        printf("is_reachable: find_all_after then search vs is_reachable\n");
+        printf("%-8s %12s %12s %12s %16s %16s\n",
+               "graph", "edges", "nodes", "reachable", "after ms", "reachable ms");
+
+        size_t edge_count = 4000000, node_count = edge_count / 4;
+
+        bench_is_reachable_graph(
+            "random",
+            make_random_dag<uint32_t>(node_count, edge_count, 10));
+
+        bench_is_reachable_graph(
+            "deep",
+            make_deep_dag<uint32_t>(node_count, edge_count, 10));
+    }
+
+    void bench_would_create_cycle()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("would_create_cycle: rebuilding with the edge vs querying\n");
+        printf("%12s %12s %12s %16s %16s\n",
+               "edges", "nodes", "cycles", "rebuild ms", "query ms");
+
+        for(size_t edge_count : {size_t(100000), size_t(1000000)})
+        {
+            size_t node_count = edge_count / 4;
+
+            auto edges = make_deep_dag<uint32_t>(node_count, edge_count, 11);
+            dag_type graph(edges.begin(), edges.end());
+
+            std::mt19937_64 rng(12);
+            std::uniform_int_distribution<uint32_t> pick(
+                0, uint32_t(graph.get_all_nodes().size() - 1));
+            std::vector<std::pair<uint32_t, uint32_t>> proposed(20);
+
+            for(auto &p : proposed)
+            {
+                p = std::make_pair(pick(rng), pick(rng));
+            }
+
+            traversal_workspace<uint32_t> workspace(graph);
+            size_t rebuilt_cycles = 0, queried_cycles = 0;
+
+            double rebuild_ms = time_ms(
+                [&]
+                {
+                    for(auto &p : proposed)
+                    {
+                        auto with_edge = edges;
+                        with_edge.emplace_back(p.first, p.second);
+
+                        dag_type rebuilt(with_edge.begin(), with_edge.end());
+                        rebuilt_cycles += !rebuilt.get_valid();
+                    }
+                });
+
+            double query_ms = time_ms(
+                [&]
+                {
+                    for(auto &p : proposed)
+                    {
+                        queried_cycles += would_create_cycle(
+                            graph, p.first, p.second, workspace);
+                    }
+                });
+
+            if(rebuilt_cycles != queried_cycles)
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_all_nodes().size(),
+                   queried_cycles,
+                   rebuild_ms,
+                   query_ms);
+        }
+    }
+
+    void bench_add_edge()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("add_edge: rebuilding per edit vs editing in place\n");
+        printf("%12s %12s %12s %12s %16s %16s\n",
+               "edges", "nodes", "edits", "accepted", "rebuild us/edit", "add us/edit");
+
+        for(size_t edge_count : {size_t(100000), size_t(1000000)})
+        {
+            size_t node_count = edge_count / 4, edit_count = 2000;
+
+            auto edges = make_random_dag<uint32_t>(node_count, edge_count, 13);
+            dag_type graph(edges.begin(), edges.end());
+
+            std::mt19937_64 rng(14);
+            std::uniform_int_distribution<uint32_t> pick(0, uint32_t(node_count - 1));
+            std::vector<std::pair<uint32_t, uint32_t>> proposed(edit_count);
+
+            for(auto &p : proposed)
+            {
+                p = std::make_pair(pick(rng), pick(rng));
+            }
+
+            // Rebuilding is slow, so time a few and scale up.
+            size_t rebuild_count = 5;
+
+            double rebuild_ms = time_ms(
+                [&]
+                {
+                    for(size_t i = 0; i < rebuild_count; ++i)
+                    {
+                        auto with_edge = edges;
+                        with_edge.emplace_back(proposed[i].first, proposed[i].second);
+
+                        dag_type rebuilt(with_edge.begin(), with_edge.end());
+                    }
+                });
+
+            size_t accepted = 0;
+
+            double add_ms = time_ms(
+                [&]
+                {
+                    for(auto &p : proposed)
+                    {
+                        accepted += graph.add_edge(p.first, p.second);
+                    }
+                });
+
+            printf("%12zu %12zu %12zu %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_all_nodes().size(),
+                   edit_count,
+                   accepted,
+                   rebuild_ms * 1000.0 / rebuild_count,
+                   add_ms * 1000.0 / edit_count);
+        }
+    }
+
+    void bench_remove()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("remove: rebuilding vs removing edges one at a time or in a batch\n");
+        printf("%12s %12s %12s %16s %16s %16s\n",
+               "edges", "nodes", "removed", "rebuild ms", "single ms", "batch ms");
+
+        for(size_t edge_count : {size_t(100000), size_t(1000000)})
+        {
+            size_t node_count = edge_count / 4, remove_count = 1000;
+
+            auto edges = make_random_dag<uint32_t>(node_count, edge_count, 15);
+            dag_type single_graph(edges.begin(), edges.end());
+            dag_type batch_graph(edges.begin(), edges.end());
+
+            std::vector<directed_edge<uint32_t>> doomed(
+                edges.begin(), edges.begin() + remove_count);
+
+            // One rebuild without the edges.
+            double rebuild_ms = time_ms(
+                [&]
+                {
+                    dag_type rebuilt(edges.begin() + remove_count, edges.end());
+                });
+
+            double single_ms = time_ms(
+                [&]
+                {
+                    for(auto &edge : doomed)
+                    {
+                        single_graph.remove_edge(edge.get_src(), edge.get_dst());
+                    }
+                });
+
+            size_t removed = 0;
+
+            double batch_ms = time_ms(
+                [&]
+                {
+                    removed = batch_graph.remove_edges(doomed.begin(), doomed.end());
+                });
+
+            if(single_graph.get_edges_by_src().size() != batch_graph.get_edges_by_src().size())
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %12zu %16.1f %16.1f %16.1f\n",
+                   edge_count,
+                   node_count,
+                   removed,
+                   rebuild_ms,
+                   single_ms,
+                   batch_ms);
+        }
+    }
+
+    void bench_apply_delta()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("apply_delta: rebuilding vs applying 50k added and 30k removed edges\n");
+        printf("%12s %12s %16s %16s\n",
+               "edges", "nodes", "rebuild ms", "delta ms");
+
+        for(size_t edge_count : {size_t(1000000), size_t(10000000)})
+        {
+            size_t node_count = edge_count / 4;
+            size_t add_count = 50000, remove_count = 30000;
+
+            // Same seed, so the first edge_count edges are the same and the
+            // rest respect the same hidden order.
+            auto all_edges = make_random_dag<uint32_t>(
+                node_count, edge_count + add_count, 16);
+
+            std::vector<directed_edge<uint32_t>>
+                edges(all_edges.begin(), all_edges.begin() + edge_count),
+                added(all_edges.begin() + edge_count, all_edges.end()),
+                removed(edges.begin(), edges.begin() + remove_count);
+
+            dag_type graph(edges.begin(), edges.end());
+
+            double rebuild_ms = time_ms(
+                [&]
+                {
+                    std::vector<directed_edge<uint32_t>> next(
+                        edges.begin() + remove_count, edges.end());
+                    next.insert(next.end(), added.begin(), added.end());
+
+                    dag_type rebuilt(next.begin(), next.end());
+                });
+
+            bool applied = false;
+
+            double delta_ms = time_ms(
+                [&] { applied = graph.apply_delta(added, removed); });
+
+            if(!applied)
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_all_nodes().size(),
+                   rebuild_ms,
+                   delta_ms);
+        }
+    }
+
+    void bench_snapshot()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("snapshot: copying the dag's vectors vs taking a snapshot, then editing\n");
+        printf("%12s %12s %16s %16s %16s %16s %16s %16s\n",
+               "edges", "nodes", "deep copy ms", "snapshot us", "first edit ms", "next edit us",
+               "lookup ns", "edited lookup ns");
+
+        for(size_t edge_count : {size_t(1000000), size_t(10000000)})
+        {
+            size_t node_count = edge_count / 4, edit_count = 1000;
+
+            auto edges = make_random_dag<uint32_t>(node_count, edge_count, 23);
+            dag_type graph(edges.begin(), edges.end());
+
+            size_t copied = 0;
+
+            // The vectors are copied out of the dag's chunks on first use,
+            // so time copying them once they exist.
+            graph.get_edges_by_src();
+            graph.get_edges_by_dst();
+            graph.get_all_nodes();
+            graph.get_sorted_nodes();
+
+            double copy_ms = time_ms(
+                [&]
+                {
+                    auto by_src = graph.get_edges_by_src();
+                    auto by_dst = graph.get_edges_by_dst();
+                    auto all_nodes = graph.get_all_nodes();
+                    auto sorted_nodes = graph.get_sorted_nodes();
+
+                    copied = by_src.size() + by_dst.size() + all_nodes.size() + sorted_nodes.size();
+                });
+
+            dag_type snapshot = graph;
+
+            double snapshot_ms = time_ms([&] { snapshot = graph.snapshot(); });
+
+            // The first edit after a snapshot copies what it changes, later
+            // ones edit in place.
+            std::mt19937_64 rng(24);
+            std::uniform_int_distribution<uint32_t> pick(0, uint32_t(node_count - 1));
+
+            double first_ms = time_ms(
+                [&] { graph.add_edge(pick(rng), pick(rng)); });
+
+            double next_ms = time_ms(
+                [&]
+                {
+                    for(size_t i = 0; i < edit_count; ++i)
+                    {
+                        graph.add_edge(pick(rng), pick(rng));
+                    }
+                });
+
+            // Random reads through the chunked arrays, on the unedited
+            // snapshot and on the edited graph.
+            std::vector<uint32_t> lookup_ids(100000);
+            std::uniform_int_distribution<uint32_t> pick_index(
+                0, uint32_t(snapshot.get_node_count() - 1));
+
+            for(auto &id : lookup_ids)
+            {
+                id = snapshot.id_of(pick_index(rng));
+            }
+
+            size_t looked_up = 0;
+
+            auto lookup_ns = [&](dag_type const &g)
+            {
+                return time_ms(
+                    [&]
+                    {
+                        for(auto id : lookup_ids)
+                        {
+                            looked_up +=
+                                g.node_at_rank(g.rank_of(id)) +
+                                g.get_successors(g.index_of(id)).size();
+                        }
+                    }) * 1000000.0 / double(lookup_ids.size());
+            };
+
+            double snapshot_lookup_ns = lookup_ns(snapshot);
+            double edited_lookup_ns = lookup_ns(graph);
+
+            if((copied == 0) || (looked_up == 0) || (snapshot.get_edge_count() != edge_count))
+            {
+                printf("mismatched results!\n");
+            }
+
+            printf("%12zu %12zu %16.1f %16.1f %16.1f %16.1f %16.1f %16.1f\n",
+                   edge_count,
+                   graph.get_node_count(),
+                   copy_ms,
+                   snapshot_ms * 1000.0,
+                   first_ms,
+                   next_ms * 1000.0 / edit_count,
+                   snapshot_lookup_ns,
+                   edited_lookup_ns);
+        }
+    }
+
+    // Read latencies across reader threads.
+    struct read_stats
+    {
+        size_t  read_count;
+        double  p50_ns, p99_ns, max_ns;
+    };
+
+    // Run reader_count threads calling read(thread, rng) for duration_ms while
+    // write() is called in a loop on this thread, if given.  Returns read
+    // latency percentiles and how many writes were done.
+    template<typename Read, typename Write>
+    read_stats run_readers(
+            unsigned reader_count,
+            double duration_ms,
+            Read &&read,
+            Write &&write,
+            size_t &write_count)
+    {
+        std::atomic<bool> done(false);
+        std::vector<std::vector<float>> latencies(reader_count);
+        std::vector<std::thread> threads;
+
+        for(unsigned t = 0; t < reader_count; ++t)
+        {
+            threads.emplace_back(
+                [&, t]
+                {
+                    std::mt19937_64 rng(100 + t);
+                    auto &out = latencies[t];
+
+                    while(!done.load(std::memory_order_relaxed))
+                    {
+                        auto start = clock_type::now();
+                        read(t, rng);
+                        auto end = clock_type::now();
+
+                        out.push_back(float(
+                            std::chrono::duration<double, std::nano>(end - start).count()));
+                    }
+                });
+        }
+
+        write_count = 0;
+
+        auto stop = clock_type::now() + std::chrono::duration<double, std::milli>(duration_ms);
+
+        while(clock_type::now() < stop)
+        {
+            if(write())
+            {
+                ++write_count;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        done = true;
+
+        for(auto &t : threads)
+        {
+            t.join();
+        }
+
+        std::vector<float> all;
+
+        for(auto &l : latencies)
+        {
+            all.insert(all.end(), l.begin(), l.end());
+        }
+
+        std::sort(all.begin(), all.end());
+
+        auto at = [&all](double q)
+        {
+            return all.empty() ? 0.0 : double(all[size_t(q * double(all.size() - 1))]);
+        };
+
+        return {all.size(), at(0.5), at(0.99), at(1.0)};
+    }
+
+    void bench_concurrent_dag()
+    {
+        using dag_type = dag<uint32_t>;
+
+        printf("concurrent_dag: reads with a shared mutex vs epoch-protected versions, writer idle or adding batches\n");
+        printf("%-10s %8s %8s %12s %10s %10s %12s\n",
+               "mode", "readers", "writes", "reads", "p50 ns", "p99 ns", "max ns");
+
+        size_t edge_count = 1000000, node_count = edge_count / 4;
+        double duration_ms = 500.0;
+
+        auto edges = make_random_dag<uint32_t>(node_count, edge_count, 25);
+        dag_type initial(edges.begin(), edges.end());
+
+        std::uniform_int_distribution<uint32_t> pick(0, uint32_t(node_count - 1));
+        std::uniform_int_distribution<uint32_t> pick_index(
+            0, uint32_t(initial.get_all_nodes().size() - 1));
+        std::atomic<size_t> checked(0);
+
+        // A read checks a random node's edges against its rank.  Edits
+        // only add nodes, so every version has the initial indices.
+        auto query = [&pick_index, &checked](dag_type const &graph, std::mt19937_64 &rng)
+        {
+            auto index = pick_index(rng);
+            auto rank = graph.get_rank(index);
+            size_t ok = 0;
+
+            for(auto dst : graph.get_successors(index))
+            {
+                ok += graph.get_rank(dst) > rank;
+            }
+
+            checked.fetch_add(ok, std::memory_order_relaxed);
+        };
+
+        // Writes add a batch of random edges, rejected if it makes a cycle.
+        auto make_batch = [&pick](std::mt19937_64 &rng)
+        {
+            dag_type::edge_vector batch;
+
+            for(int i = 0; i < 1000; ++i)
+            {
+                batch.emplace_back(pick(rng), pick(rng));
+            }
+
+            return batch;
+        };
+
+        auto print = [](char const *mode, unsigned readers, size_t writes, read_stats const &stats)
+        {
+            printf("%-10s %8u %8zu %12zu %10.0f %10.0f %12.0f\n",
+                   mode, readers, writes, stats.read_count,
+                   stats.p50_ns, stats.p99_ns, stats.max_ns);
+        };
+
+        for(unsigned readers : {1u, 2u, 4u, 8u})
+        {
+            for(bool updating : {false, true})
+            {
+                // Writer edits in place under an exclusive lock.
+                {
+                    dag_type graph = initial;
+                    std::shared_timed_mutex mutex;
+                    std::mt19937_64 rng(26);
+                    size_t writes = 0;
+
+                    auto stats = run_readers(
+                        readers,
+                        duration_ms,
+                        [&](unsigned, std::mt19937_64 &reader_rng)
+                        {
+                            std::shared_lock<std::shared_timed_mutex> lock(mutex);
+                            query(graph, reader_rng);
+                        },
+                        [&]
+                        {
+                            if(!updating)
+                            {
+                                return false;
+                            }
+
+                            auto batch = make_batch(rng);
+
+                            std::lock_guard<std::shared_timed_mutex> lock(mutex);
+                            graph.apply_delta(batch, {});
+                            return true;
+                        },
+                        writes);
+
+                    print(updating ? "mutex upd" : "mutex", readers, writes, stats);
+                }
+
+                // Writer publishes edited snapshots.
+                {
+                    concurrent_dag<uint32_t> graph(initial);
+                    std::mt19937_64 rng(26);
+                    size_t writes = 0;
+
+                    std::vector<concurrent_dag<uint32_t>::reader_handle> handles;
+
+                    for(unsigned t = 0; t < readers; ++t)
+                    {
+                        handles.push_back(graph.register_reader());
+                    }
+
+                    auto stats = run_readers(
+                        readers,
+                        duration_ms,
+                        [&](unsigned t, std::mt19937_64 &reader_rng)
+                        {
+                            auto guard = handles[t].read();
+                            query(*guard, reader_rng);
+                        },
+                        [&]
+                        {
+                            if(!updating)
+                            {
+                                return false;
+                            }
+
+                            auto batch = make_batch(rng);
+
+                            graph.update(
+                                [&](dag_type &next)
+                                {
+                                    return next.apply_delta(batch, {});
+                                });
+                            return true;
+                        },
+                        writes);
+
+                    print(updating ? "epoch upd" : "epoch", readers, writes, stats);
+                }
+            }
+        }
+
+        if(checked.load() == 0)
+        {
+            printf("mismatched results!\n");
+        }
+    }
+
+    struct benchmark
+    {
+        char const  *name;
+        void        (*run)();
+    };
+
+    benchmark const benchmarks[] =
+    {
+        {"topological_sort", bench_topological_sort},
+        {"sort", bench_sort},
+        {"find_all_after", bench_find_all_after},
+        {"ready_tracker", bench_ready_tracker},
+        {"level_sort", bench_level_sort},
+        {"closure", bench_closure},
+        {"interval_index", bench_interval_index},
+        {"is_reachable", bench_is_reachable},
+        {"would_create_cycle", bench_would_create_cycle},
+        {"add_edge", bench_add_edge},
+        {"remove", bench_remove},
+        {"apply_delta", bench_apply_delta},
+        {"snapshot", bench_snapshot},
+        {"concurrent_dag", bench_concurrent_dag},
+    };
+}
+
+// Usage: bench [name]
+// Runs every benchmark, or just the one named.
+int main(int argc, char **argv)
+{
+    for(auto &b : benchmarks)
+    {
+        if((argc < 2) || (strcmp(argv[1], b.name) == 0))
+        {
+            b.run();
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
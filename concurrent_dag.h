@@ -0,0 +1,265 @@
+#ifndef INCLUDED_S3D_DAG_CONCURRENT_DAG_H
+#define INCLUDED_S3D_DAG_CONCURRENT_DAG_H
+
+#include "dag.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace s3d_graph
+{
+    // A dag that many threads can read while one thread updates it.
+    //
+    // Versions are immutable once published through an atomic pointer.
+    // The writer builds the next version from a snapshot of the current
+    // one, so only the chunks an update touches are copied, then swaps it
+    // in.  Readers never lock or wait: entering a read announces the
+    // current epoch in the reader's slot and loads the pointer, leaving
+    // clears the slot.  Old versions are retired with the epoch that
+    // replaced them and freed by the writer once no reader announced an
+    // earlier epoch.
+    //
+    // Any number of readers up to max_readers, each with its own
+    // reader_handle, and one writer at a time.  Handles must be destroyed
+    // before the concurrent_dag.
+    template<typename T>
+    class concurrent_dag
+    {
+        struct reader_slot;
+
+    public:
+        using dag_type = dag<T>;
+
+        // Keeps a version alive while it is read.  Movable, one per
+        // handle at a time.
+        class read_guard
+        {
+        public:
+            read_guard(read_guard &&other)
+                : m_slot(other.m_slot)
+                , m_graph(other.m_graph)
+            {
+                other.m_slot = nullptr;
+            }
+
+            read_guard(read_guard const &) = delete;
+            read_guard &operator=(read_guard const &) = delete;
+            read_guard &operator=(read_guard &&) = delete;
+
+            ~read_guard()
+            {
+                if(m_slot)
+                {
+                    m_slot->epoch.store(idle_epoch, std::memory_order_release);
+                }
+            }
+
+            dag_type const &get() const { return *m_graph; }
+            dag_type const &operator*() const { return *m_graph; }
+            dag_type const *operator->() const { return m_graph; }
+
+        private:
+            friend class concurrent_dag;
+
+            read_guard(reader_slot *slot, dag_type const *graph)
+                : m_slot(slot)
+                , m_graph(graph)
+            {
+            }
+
+            reader_slot         *m_slot;
+            dag_type const      *m_graph;
+        };
+
+        // A reader's registration, holding one slot until destroyed.
+        class reader_handle
+        {
+        public:
+            reader_handle(reader_handle &&other)
+                : m_owner(other.m_owner)
+                , m_slot(other.m_slot)
+            {
+                other.m_slot = nullptr;
+            }
+
+            reader_handle(reader_handle const &) = delete;
+            reader_handle &operator=(reader_handle const &) = delete;
+            reader_handle &operator=(reader_handle &&) = delete;
+
+            ~reader_handle()
+            {
+                if(m_slot)
+                {
+                    m_slot->claimed.store(false, std::memory_order_release);
+                }
+            }
+
+            // false if every slot was taken.
+            bool get_valid() const { return m_slot != nullptr; }
+
+            // Start reading the current version.  Wait-free.  The handle
+            // must be valid and not already reading.
+            read_guard read() const
+            {
+                auto epoch = m_owner->m_epoch.load(std::memory_order_seq_cst);
+
+                // Announce before loading the pointer, so a writer either
+                // sees the announcement or we see its newer version.
+                m_slot->epoch.store(epoch, std::memory_order_seq_cst);
+
+                return read_guard(
+                    m_slot,
+                    m_owner->m_current.load(std::memory_order_seq_cst));
+            }
+
+        private:
+            friend class concurrent_dag;
+
+            reader_handle(concurrent_dag const *owner, reader_slot *slot)
+                : m_owner(owner)
+                , m_slot(slot)
+            {
+            }
+
+            concurrent_dag const    *m_owner;
+            reader_slot             *m_slot;
+        };
+
+        explicit concurrent_dag(dag_type initial, size_t max_readers = 64)
+            : m_slots(new reader_slot[max_readers])
+            , m_slot_count(max_readers)
+            , m_current(new dag_type(std::move(initial)))
+            , m_epoch(1)
+        {
+        }
+
+        concurrent_dag(concurrent_dag const &) = delete;
+        concurrent_dag &operator=(concurrent_dag const &) = delete;
+
+        ~concurrent_dag()
+        {
+            delete m_current.load();
+        }
+
+        // Claim a reader slot.  Thread safe.  Check get_valid() on the
+        // result, as there are only max_readers slots.
+        reader_handle register_reader() const
+        {
+            for(size_t i = 0; i < m_slot_count; ++i)
+            {
+                bool expected = false;
+
+                if(!m_slots[i].claimed.load(std::memory_order_relaxed) &&
+                   m_slots[i].claimed.compare_exchange_strong(
+                        expected, true, std::memory_order_acquire))
+                {
+                    return reader_handle(this, &m_slots[i]);
+                }
+            }
+
+            return reader_handle(this, nullptr);
+        }
+
+        // Writer only.  The version readers currently get.
+        dag_type const &get_current() const
+        {
+            return *m_current.load(std::memory_order_relaxed);
+        }
+
+        // Writer only.  Publish a new version, retiring the current one.
+        void publish(dag_type next)
+        {
+            auto old = m_current.exchange(
+                new dag_type(std::move(next)), std::memory_order_seq_cst);
+
+            // Readers announcing this epoch or later started after the
+            // exchange, so can't hold the old version.
+            auto retire_epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+            m_retired.emplace_back(retire_epoch, std::unique_ptr<dag_type const>(old));
+
+            reclaim();
+        }
+
+        // Writer only.  Edit a snapshot of the current version with
+        // edit(dag_type &), publishing it if edit returns true.  Returns
+        // what edit did.
+        template<typename Fn>
+        bool update(Fn &&edit)
+        {
+            auto next = get_current().snapshot();
+
+            if(!edit(next))
+            {
+                return false;
+            }
+
+            publish(std::move(next));
+            return true;
+        }
+
+        // Writer only.  Free retired versions no reader can still see.
+        // Called by publish(), so only needed to free the last versions
+        // once updates stop.
+        void reclaim()
+        {
+            auto oldest = idle_epoch;
+
+            for(size_t i = 0; i < m_slot_count; ++i)
+            {
+                oldest = std::min(
+                    oldest, m_slots[i].epoch.load(std::memory_order_seq_cst));
+            }
+
+            m_retired.erase(
+                std::remove_if(
+                    m_retired.begin(),
+                    m_retired.end(),
+                    [oldest](retired_version const &r){return r.first <= oldest;}),
+                m_retired.end());
+        }
+
+        // Writer only.  Versions retired but not yet freed.
+        size_t get_retired_count() const
+        {
+            return m_retired.size();
+        }
+
+    private:
+        static constexpr std::uint64_t idle_epoch = ~std::uint64_t(0);
+
+        // A cache line per reader, so announcing doesn't contend.  The
+        // alignment also makes new[] use the over-aligned allocator, so
+        // slots start on a line boundary.
+        struct alignas(64) reader_slot
+        {
+            reader_slot()
+                : epoch(idle_epoch)
+                , claimed(false)
+            {
+            }
+
+            std::atomic<std::uint64_t>  epoch;
+            std::atomic<bool>           claimed;
+        };
+
+        using retired_version = std::pair<std::uint64_t, std::unique_ptr<dag_type const>>;
+
+        std::unique_ptr<reader_slot[]>  m_slots;
+        size_t                          m_slot_count;
+
+        std::atomic<dag_type const *>   m_current;
+        std::atomic<std::uint64_t>      m_epoch;
+
+        // Writer side: old versions and the epoch that replaced them.
+        std::vector<retired_version>    m_retired;
+    };
+
+    template<typename T>
+    constexpr std::uint64_t concurrent_dag<T>::idle_epoch;
+}
+
+#endif
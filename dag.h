@@ -2,11 +2,17 @@
 #define INCLUDED_S3D_DAG_H
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include <queue>
 
 namespace s3d_graph
 {
@@ -35,291 +41,3633 @@ namespace s3d_graph
         node_id_type m_src, m_dst;
     };
 
-    template<typename NodeID>
-    class dag
+    // A read-only view of a contiguous run of values, for example a node's
+    // successors in a dag.
+    template<typename T>
+    class const_span
     {
     public:
-        using node_id_type      = NodeID;
-        using node_id_vector    = std::vector<node_id_type>;
-        using edge_type         = directed_edge<node_id_type>;
-        using edge_vector       = std::vector<edge_type>;
+        using value_type        = T;
+        using const_iterator    = T const *;
+
+        const_span()
+            : m_begin(nullptr)
+            , m_end(nullptr)
+        {
+        }
+
+        const_span(T const *begin, T const *end)
+            : m_begin(begin)
+            , m_end(end)
+        {
+        }
+
+        const_iterator begin() const { return m_begin; }
+        const_iterator end() const { return m_end; }
+
+        size_t size() const { return size_t(m_end - m_begin); }
+        bool empty() const { return m_begin == m_end; }
+
+        T const &operator[](size_t i) const { return m_begin[i]; }
+    private:
+        T const *m_begin, *m_end;
+    };
+
+    // Holds a value that copies share until one of them writes to it.
+    // Copying is a reference count increment; write() first clones the
+    // value if anything else still refers to it.
+    //
+    // Shared values are only ever read, so copies may be read from any
+    // thread, but each copy must only be written through by one thread.
+    template<typename T>
+    class copy_on_write
+    {
+    public:
+        using value_type = T;
+
+        copy_on_write()
+            : m_value(std::make_shared<T>())
+        {
+        }
+
+        // No moves, so a moved-from holder still holds a value.
+        copy_on_write(copy_on_write const &) = default;
+        copy_on_write &operator=(copy_on_write const &) = default;
+
+        T const &get() const { return *m_value; }
+        T const *operator->() const { return m_value.get(); }
+
+        // Is the value shared with another copy?
+        bool get_shared() const { return m_value.use_count() != 1; }
+
+        // Get the value for writing, cloning it if it's shared.
+        T &write()
+        {
+            if(get_shared())
+            {
+                m_value = std::make_shared<T>(*m_value);
+            }
+            else
+            {
+                // The last other owner may have just let go on another
+                // thread; see its reads before writing.
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+
+            return *m_value;
+        }
+
+        // Get the value for overwriting.  If it's shared, this is a new
+        // default value rather than a clone.
+        T &replace()
+        {
+            if(get_shared())
+            {
+                m_value = std::make_shared<T>();
+            }
+            else
+            {
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+
+            return *m_value;
+        }
+
+        // Read-only container access, for wrapped vectors.
+        size_t size() const { return get().size(); }
+        bool empty() const { return get().empty(); }
+        auto begin() const { return get().begin(); }
+        auto end() const { return get().end(); }
+        auto data() const { return get().data(); }
+        decltype(auto) front() const { return get().front(); }
+        decltype(auto) back() const { return get().back(); }
+        decltype(auto) operator[](size_t i) const { return get()[i]; }
+
+    private:
+        std::shared_ptr<T> m_value;
+    };
+
+    // A vector filled on first use.  get() may be called from several
+    // threads at once, and only the first fills it; reset() empties it
+    // again and must not race with anything.  Copies start out empty.
+    template<typename T>
+    class lazy_vector
+    {
+    public:
+        lazy_vector()
+            : m_filled(false)
+        {
+        }
+
+        lazy_vector(lazy_vector const &)
+            : m_filled(false)
+        {
+        }
+
+        lazy_vector &operator=(lazy_vector const &)
+        {
+            reset();
+            return *this;
+        }
+
+        // Get the vector, calling fill(vector) first if it's empty.
+        template<typename Fill>
+        std::vector<T> const &get(Fill fill) const
+        {
+            if(!m_filled.load(std::memory_order_acquire))
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if(!m_filled.load(std::memory_order_relaxed))
+                {
+                    fill(m_value);
+                    m_filled.store(true, std::memory_order_release);
+                }
+            }
+
+            return m_value;
+        }
+
+        // Empty the vector, freeing its memory.
+        void reset()
+        {
+            if(m_filled.load(std::memory_order_relaxed))
+            {
+                std::vector<T>().swap(m_value);
+                m_filled.store(false, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        mutable std::mutex          m_mutex;
+        mutable std::atomic<bool>   m_filled;
+        mutable std::vector<T>      m_value;
+    };
+
+    // A sequence stored as chunks, which copies share until one of them
+    // writes to a chunk.  Copying copies a table of chunk pointers;
+    // writing an element, or inserting or erasing near it, first clones
+    // its chunk if anything else still refers to it.  So an edit to a
+    // copy costs the chunks it touches, not the whole array.
+    //
+    // Assigning or appending fills chunks of chunk_size, and indexing is
+    // then a shift and a mask.  Inserting in the middle grows one chunk,
+    // splitting it at twice chunk_size, and erasing merges a chunk left
+    // under half full into the next.  So every chunk but the last holds
+    // chunk_size / 2 to 2 * chunk_size values, and indexing looks up the
+    // chunk holding each chunk_size'th position, then steps over at most
+    // two chunk starts: still O(1).  Iterating is O(1) per element.
+    //
+    // get_contiguous() copies the values out into one std::vector, for
+    // callers that want one.  The copy is made on first use and kept
+    // until the next change.
+    //
+    // As with copy_on_write, shared chunks are only ever read, so copies
+    // may be read from any thread, but each copy must only be written
+    // through by one thread.
+    template<typename T>
+    class chunked_vector
+    {
+    public:
+        using value_type = T;
+
+        static constexpr unsigned   chunk_shift = 12;
+        static constexpr size_t     chunk_size  = size_t(1) << chunk_shift;
+
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type        = T;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = T const *;
+            using reference         = T const &;
+
+            const_iterator()
+                : m_owner(nullptr)
+                , m_chunk(0)
+                , m_ptr(nullptr)
+                , m_chunk_end(nullptr)
+            {
+            }
+
+            const_iterator(chunked_vector const *owner, size_t pos)
+                : m_owner(owner)
+            {
+                seek(pos);
+            }
+
+            reference operator*() const { return *m_ptr; }
+            pointer operator->() const { return m_ptr; }
+            reference operator[](difference_type n) const { return *(*this + n); }
+
+            const_iterator &operator++()
+            {
+                if(++m_ptr == m_chunk_end)
+                {
+                    enter_chunk(m_chunk + 1);
+                }
+
+                return *this;
+            }
+
+            const_iterator &operator--() { seek(get_pos() - 1); return *this; }
+            const_iterator operator++(int) { auto old = *this; ++*this; return old; }
+            const_iterator operator--(int) { auto old = *this; --*this; return old; }
+
+            const_iterator &operator+=(difference_type n) { seek(get_pos() + size_t(n)); return *this; }
+            const_iterator &operator-=(difference_type n) { seek(get_pos() - size_t(n)); return *this; }
+
+            const_iterator operator+(difference_type n) const { auto it = *this; return it += n; }
+            const_iterator operator-(difference_type n) const { auto it = *this; return it -= n; }
+
+            friend const_iterator operator+(difference_type n, const_iterator const &it) { return it + n; }
+
+            difference_type operator-(const_iterator const &other) const
+            {
+                return difference_type(get_pos()) - difference_type(other.get_pos());
+            }
+
+            bool operator==(const_iterator const &other) const { return m_ptr == other.m_ptr; }
+            bool operator!=(const_iterator const &other) const { return m_ptr != other.m_ptr; }
+            bool operator<(const_iterator const &other) const { return get_pos() < other.get_pos(); }
+            bool operator>(const_iterator const &other) const { return other < *this; }
+            bool operator<=(const_iterator const &other) const { return !(other < *this); }
+            bool operator>=(const_iterator const &other) const { return !(*this < other); }
+        private:
+            size_t get_pos() const
+            {
+                if(!m_ptr)
+                {
+                    return m_owner ? m_owner->size() : 0;
+                }
+
+                return
+                    m_owner->m_starts[m_chunk] +
+                    size_t(m_ptr - m_owner->m_data[m_chunk]);
+            }
+
+            void seek(size_t pos)
+            {
+                if(pos >= m_owner->size())
+                {
+                    enter_chunk(m_owner->m_data.size());
+                    return;
+                }
+
+                auto chunk = m_owner->chunk_of(pos);
+
+                enter_chunk(chunk);
+                m_ptr += pos - m_owner->m_starts[chunk];
+            }
+
+            // Point at the start of a chunk, or at the end past the last.
+            // Chunks are never empty.
+            void enter_chunk(size_t chunk)
+            {
+                m_chunk = chunk;
+
+                if(chunk < m_owner->m_data.size())
+                {
+                    m_ptr = m_owner->m_data[chunk];
+                    m_chunk_end = m_ptr + m_owner->get_chunk_count(chunk);
+                }
+                else
+                {
+                    m_ptr = nullptr;
+                    m_chunk_end = nullptr;
+                }
+            }
+
+            chunked_vector const    *m_owner;
+            size_t                  m_chunk;
+            T const                 *m_ptr,
+                                    *m_chunk_end;
+        };
+
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        chunked_vector()
+            : m_starts(1, 0)
+            , m_base(nullptr)
+            , m_uniform(true)
+        {
+        }
+
+        size_t size() const { return m_starts.back(); }
+        bool empty() const { return size() == 0; }
+
+        T const &operator[](size_t i) const
+        {
+            return m_base ? m_base[i] : find(i);
+        }
+
+        T const &front() const { return (*this)[0]; }
+        T const &back() const { return (*this)[size() - 1]; }
+
+        // The values as one vector.  O(n) the first time after a change,
+        // then O(1).  Safe to call from several threads at once.
+        std::vector<T> const &get_contiguous() const
+        {
+            return m_contiguous.get(
+                [this](std::vector<T> &values)
+                {
+                    values.reserve(size());
+
+                    for(size_t c = 0; c < m_data.size(); ++c)
+                    {
+                        values.insert(values.end(), m_data[c], m_data[c] + get_chunk_count(c));
+                    }
+                });
+        }
+
+        const_iterator begin() const { return {this, 0}; }
+        const_iterator end() const { return {this, size()}; }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        friend bool operator==(chunked_vector const &a, chunked_vector const &b)
+        {
+            return (a.size() == b.size()) && std::equal(a.begin(), a.end(), b.begin());
+        }
+
+        friend bool operator!=(chunked_vector const &a, chunked_vector const &b)
+        {
+            return !(a == b);
+        }
+
+        // Replace the contents with [first, last).
+        template<typename InputIterator>
+        void assign(InputIterator first, InputIterator last)
+        {
+            assign(std::vector<T>(first, last));
+        }
+
+        // Replace the contents with values, without copying them.  The
+        // chunks are slices of values until each is first written to.
+        void assign(std::vector<T> &&values)
+        {
+            clear();
+
+            if(values.empty())
+            {
+                return;
+            }
+
+            auto count = values.size();
+            auto owner = std::make_shared<std::vector<T>>(std::move(values));
+
+            for(size_t first = 0; first < count; first += chunk_size)
+            {
+                m_owners.push_back(owner);
+                m_data.push_back(owner->data() + first);
+                m_starts.push_back(std::min(first + chunk_size, count));
+            }
+
+            m_base = owner->data();
+        }
+
+        void clear()
+        {
+            m_contiguous.reset();
+            m_owners.clear();
+            m_data.clear();
+            m_starts.assign(1, 0);
+            m_lookup.clear();
+            m_base = nullptr;
+            m_uniform = true;
+        }
+
+        // Append a value, to the last chunk unless it is full.
+        void push_back(T const &value)
+        {
+            m_contiguous.reset();
+            m_base = nullptr;
+
+            if(m_data.empty() || (get_chunk_count(m_data.size() - 1) >= chunk_size))
+            {
+                auto owner = std::make_shared<std::vector<T>>(1, value);
+
+                owner->reserve(chunk_size);
+                m_owners.push_back(owner);
+                m_data.push_back(owner->data());
+                m_starts.push_back(m_starts.back() + 1);
+            }
+            else
+            {
+                auto last = m_data.size() - 1;
+
+                write_chunk(last).push_back(value);
+                refresh(last);
+                ++m_starts.back();
+            }
+
+            // The new value is in the last chunk, as is any lookup entry
+            // it needs.
+            if(!m_uniform && (((size() - 1) >> chunk_shift) == m_lookup.size()))
+            {
+                m_lookup.push_back(m_data.size() - 1);
+            }
+        }
+
+        // Insert a value before position pos.  O(chunk_size) plus the
+        // chunk count.
+        void insert(size_t pos, T const &value)
+        {
+            if(pos == size())
+            {
+                push_back(value);
+                return;
+            }
+
+            auto chunk_index = chunk_of(pos);
+            auto &chunk = write_chunk(chunk_index);
+
+            chunk.insert(chunk.begin() + std::ptrdiff_t(pos - m_starts[chunk_index]), value);
+
+            for(auto i = chunk_index + 1; i < m_starts.size(); ++i)
+            {
+                ++m_starts[i];
+            }
+
+            // The last chunk spills into a new one, keeping the others
+            // full.  Any other chunk grows, to twice chunk_size.
+            bool last = (chunk_index + 1 == m_data.size());
+
+            if(chunk.size() > (last ? chunk_size : 2 * chunk_size))
+            {
+                auto tail = std::make_shared<std::vector<T>>(
+                    chunk.begin() + std::ptrdiff_t(chunk_size),
+                    chunk.end());
+
+                chunk.resize(chunk_size);
+
+                m_owners.insert(m_owners.begin() + std::ptrdiff_t(chunk_index + 1), tail);
+                m_data.insert(m_data.begin() + std::ptrdiff_t(chunk_index + 1), tail->data());
+
+                m_starts.insert(
+                    m_starts.begin() + std::ptrdiff_t(chunk_index + 1),
+                    m_starts[chunk_index] + chunk_size);
+            }
+
+            refresh(chunk_index);
+            reindex();
+        }
+
+        // Overwrite the value at pos.
+        void set(size_t pos, T const &value)
+        {
+            auto chunk = chunk_of(pos);
+            write_chunk(chunk)[pos - m_starts[chunk]] = value;
+        }
+
+        // Remove the value at pos.
+        void erase(size_t pos)
+        {
+            erase_if(pos, pos + 1, [](T const &){return true;});
+        }
+
+        // Remove the values in [first, last) that match pred, keeping the
+        // order of the rest.  pred is called once per value, in order, and
+        // only chunks with matches, and the chunks after any left under
+        // half full, are written to.  Returns how many were removed.
+        template<typename Pred>
+        size_t erase_if(size_t first, size_t last, Pred pred)
+        {
+            last = std::min(last, size());
+
+            if(first >= last)
+            {
+                return 0;
+            }
+
+            std::vector<size_t> removed_from(m_data.size(), 0);
+            std::vector<std::uint8_t> matched;
+            size_t removed = 0;
+
+            for(auto c = chunk_of(first); (c < m_data.size()) && (m_starts[c] < last); ++c)
+            {
+                auto lo = std::max(first, m_starts[c]) - m_starts[c];
+                auto hi = std::min(last, m_starts[c + 1]) - m_starts[c];
+                T const *data = m_data[c];
+                size_t count = 0;
+
+                matched.assign(hi - lo, 0);
+
+                for(auto i = lo; i < hi; ++i)
+                {
+                    if(pred(data[i]))
+                    {
+                        matched[i - lo] = 1;
+                        ++count;
+                    }
+                }
+
+                if(count == 0)
+                {
+                    continue;
+                }
+
+                auto &chunk = write_chunk(c);
+                auto out = lo;
+
+                for(auto i = lo; i < hi; ++i)
+                {
+                    if(!matched[i - lo])
+                    {
+                        chunk[out++] = chunk[i];
+                    }
+                }
+
+                chunk.erase(
+                    chunk.begin() + std::ptrdiff_t(out),
+                    chunk.begin() + std::ptrdiff_t(hi));
+
+                refresh(c);
+                removed_from[c] = count;
+                removed += count;
+            }
+
+            if(removed == 0)
+            {
+                return 0;
+            }
+
+            // Recount starts, dropping emptied chunks.  Starts are
+            // rewritten behind the reads.
+            size_t kept = 0, old_start = 0;
+
+            for(size_t c = 0; c < m_data.size(); ++c)
+            {
+                auto count = m_starts[c + 1] - old_start - removed_from[c];
+
+                old_start = m_starts[c + 1];
+
+                if(count != 0)
+                {
+                    m_owners[kept] = std::move(m_owners[c]);
+                    m_data[kept] = m_data[c];
+                    m_starts[kept + 1] = m_starts[kept] + count;
+                    ++kept;
+                }
+            }
+
+            m_owners.resize(kept);
+            m_data.resize(kept);
+            m_starts.resize(kept + 1);
+
+            // Merge chunks left under half full into the next, splitting
+            // the result in two if it's too big for one chunk, until each
+            // is at least half full or the last.
+            for(size_t c = 0; c + 1 < m_data.size();)
+            {
+                if(get_chunk_count(c) >= chunk_size / 2)
+                {
+                    ++c;
+                    continue;
+                }
+
+                T const *next = m_data[c + 1];
+                auto next_count = get_chunk_count(c + 1);
+                auto &chunk = write_chunk(c);
+
+                chunk.insert(chunk.end(), next, next + next_count);
+
+                m_owners.erase(m_owners.begin() + std::ptrdiff_t(c + 1));
+                m_data.erase(m_data.begin() + std::ptrdiff_t(c + 1));
+                m_starts.erase(m_starts.begin() + std::ptrdiff_t(c + 1));
+
+                if(chunk.size() > 2 * chunk_size)
+                {
+                    auto half = chunk.size() / 2;
+                    auto tail = std::make_shared<std::vector<T>>(
+                        chunk.begin() + std::ptrdiff_t(half),
+                        chunk.end());
+
+                    chunk.resize(half);
+
+                    m_owners.insert(m_owners.begin() + std::ptrdiff_t(c + 1), tail);
+                    m_data.insert(m_data.begin() + std::ptrdiff_t(c + 1), tail->data());
+                    m_starts.insert(m_starts.begin() + std::ptrdiff_t(c + 1), m_starts[c] + half);
+                }
+
+                refresh(c);
+            }
+
+            reindex();
+
+            return removed;
+        }
+
+    private:
+        // The value at position i, from the chunk table.
+        T const &find(size_t i) const
+        {
+            if(m_uniform)
+            {
+                return m_data[i >> chunk_shift][i & (chunk_size - 1)];
+            }
+
+            auto chunk = chunk_of(i);
+            return m_data[chunk][i - m_starts[chunk]];
+        }
+
+        // The chunk holding position i, which must be below size().
+        size_t chunk_of(size_t i) const
+        {
+            if(m_uniform)
+            {
+                return i >> chunk_shift;
+            }
+
+            auto chunk = m_lookup[i >> chunk_shift];
+
+            while(m_starts[chunk + 1] <= i)
+            {
+                ++chunk;
+            }
+
+            return chunk;
+        }
+
+        // Recompute m_uniform, and m_lookup if it's false.  O(chunk count + size() / chunk_size).
+        void reindex()
+        {
+            m_uniform = true;
+
+            for(size_t c = 0; m_uniform && (c < m_data.size()); ++c)
+            {
+                auto count = get_chunk_count(c);
+
+                m_uniform = (c + 1 == m_data.size()) ?
+                    (count <= chunk_size) :
+                    (count == chunk_size);
+            }
+
+            m_lookup.clear();
+
+            if(m_uniform)
+            {
+                return;
+            }
+
+            for(size_t pos = 0, chunk = 0; pos < size(); pos += chunk_size)
+            {
+                while(m_starts[chunk + 1] <= pos)
+                {
+                    ++chunk;
+                }
+
+                m_lookup.push_back(chunk);
+            }
+        }
+
+        size_t get_chunk_count(size_t chunk) const
+        {
+            return m_starts[chunk + 1] - m_starts[chunk];
+        }
+
+        // Get a chunk for writing, cloning it if it's shared or a slice.
+        // Call refresh() after anything that may reallocate it.
+        std::vector<T> &write_chunk(size_t chunk)
+        {
+            m_contiguous.reset();
+            m_base = nullptr;
+
+            auto &owner = m_owners[chunk];
+            auto &data = m_data[chunk];
+            auto count = get_chunk_count(chunk);
+
+            if((owner.use_count() != 1) ||
+               (owner->data() != data) ||
+               (owner->size() != count))
+            {
+                owner = std::make_shared<std::vector<T>>(data, data + count);
+                data = owner->data();
+            }
+            else
+            {
+                // The last other owner may have just let go on another
+                // thread; see its reads before writing.
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+
+            return *owner;
+        }
+
+        void refresh(size_t chunk)
+        {
+            m_data[chunk] = m_owners[chunk]->data();
+        }
+
+        // A chunk is m_data[i] up to the next start.  Its owner may be a
+        // larger adopted vector it is a slice of.  Data pointers are kept
+        // apart from owners so lookups touch a dense table.
+        std::vector<std::shared_ptr<std::vector<T>>>    m_owners;
+        std::vector<T *>                                m_data;
+
+        // Position of the first value of each chunk, then the size.
+        std::vector<size_t>                             m_starts;
+
+        // The chunk holding position i * chunk_size, for each i, unless
+        // m_uniform.
+        std::vector<size_t>                             m_lookup;
+
+        // The adopted vector every chunk is a slice of, in order, until the
+        // first write, so lookups can skip the chunk table.
+        T const                                         *m_base;
+
+        // Is every chunk but the last full, and the last no bigger?
+        bool                                            m_uniform;
+
+        lazy_vector<T>                                  m_contiguous;
+    };
+
+    template<typename T>
+    constexpr unsigned chunked_vector<T>::chunk_shift;
+
+    template<typename T>
+    constexpr size_t chunked_vector<T>::chunk_size;
+
+    // Rows of sorted indices in compressed sparse row form, such as a
+    // dag's adjacency, split into blocks of block_rows consecutive rows.
+    // Each block has its own offsets and values, so a row is still one
+    // contiguous span.  Copies share blocks until one of them writes to a
+    // block, so editing a row clones only its block.
+    //
+    // Until then, blocks are slices of the offsets and values assign()
+    // adopted, which lie in memory as they would in one flat array.
+    class chunked_rows
+    {
+    public:
+        using index_type    = std::uint32_t;
+        using index_vector  = std::vector<index_type>;
+        using row_span      = const_span<index_type>;
+
+        static constexpr unsigned   block_shift = 10;
+        static constexpr size_t     block_rows  = size_t(1) << block_shift;
+
+        chunked_rows()
+            : m_block_starts(1, 0)
+            , m_row_count(0)
+        {
+        }
+
+        // Number of rows.
+        size_t size() const { return m_row_count; }
+
+        // Number of values in all rows.
+        size_t get_value_count() const { return m_block_starts.back(); }
+
+        row_span operator[](size_t row) const
+        {
+            auto &b = m_blocks[row >> block_shift];
+            auto local = row & (block_rows - 1);
+
+            return {b.values + b.offsets[local], b.values + b.offsets[local + 1]};
+        }
+
+        // Position of a row's first value among all the values, taken row
+        // by row.  Rows past the last start at get_value_count().
+        size_t get_row_start(size_t row) const
+        {
+            if(row >= m_row_count)
+            {
+                return get_value_count();
+            }
+
+            auto block_index = row >> block_shift;
+
+            auto offsets = m_blocks[block_index].offsets;
+
+            return
+                m_block_starts[block_index] +
+                (offsets[row & (block_rows - 1)] - offsets[0]);
+        }
+
+        // The row holding the value at position pos, skipping empty rows,
+        // or size() if pos is past the last value.
+        size_t get_row_of(size_t pos) const
+        {
+            if(pos >= get_value_count())
+            {
+                return m_row_count;
+            }
+
+            auto block_index = size_t(
+                std::upper_bound(m_block_starts.begin(), m_block_starts.end(), pos) -
+                m_block_starts.begin() - 1);
+
+            auto offsets = m_blocks[block_index].offsets;
+            auto local = size_t(
+                std::upper_bound(
+                    offsets,
+                    offsets + block_rows + 1,
+                    index_type(pos - m_block_starts[block_index] + offsets[0])) - offsets - 1);
+
+            return (block_index << block_shift) + local;
+        }
+
+        // Replace the rows with offsets.size() - 1 rows, row i being
+        // values[offsets[i]] to values[offsets[i + 1]], without copying
+        // either.  Blocks are slices of them until each is first written
+        // to.
+        void assign(index_vector &&offsets, index_vector &&values)
+        {
+            m_blocks.clear();
+            m_owners.clear();
+            m_block_starts.assign(1, 0);
+            m_row_count = offsets.size() - 1;
+
+            // Rows past the last are empty.
+            auto block_count = (m_row_count + block_rows - 1) >> block_shift;
+
+            offsets.resize(block_count * block_rows + 1, offsets.back());
+
+            auto offsets_owner = std::make_shared<index_vector>(std::move(offsets));
+            auto values_owner = std::make_shared<index_vector>(std::move(values));
+
+            for(size_t b = 0; b < block_count; ++b)
+            {
+                auto block_offsets = offsets_owner->data() + b * block_rows;
+
+                m_blocks.push_back(block{block_offsets, values_owner->data()});
+                m_owners.push_back(block_owners{offsets_owner, values_owner});
+
+                m_block_starts.push_back(block_offsets[block_rows]);
+            }
+        }
+
+        // Append an empty row.
+        void push_row()
+        {
+            // Rows past the last in a block are already empty.
+            if((m_row_count & (block_rows - 1)) == 0)
+            {
+                auto block_offsets = std::make_shared<index_vector>(block_rows + 1, 0);
+                auto values = std::make_shared<index_vector>();
+
+                m_blocks.push_back(block{block_offsets->data(), values->data()});
+                m_owners.push_back(block_owners{block_offsets, values});
+
+                m_block_starts.push_back(m_block_starts.back());
+            }
+
+            ++m_row_count;
+        }
+
+        // Add value to a row, keeping it sorted.
+        void insert(size_t row, index_type value)
+        {
+            auto block_index = row >> block_shift;
+            auto local = row & (block_rows - 1);
+            auto &values = write_block(block_index);
+            auto offsets = m_blocks[block_index].offsets;
+
+            values.insert(
+                std::upper_bound(
+                    values.begin() + offsets[local],
+                    values.begin() + offsets[local + 1],
+                    value),
+                value);
+
+            m_blocks[block_index].values = values.data();
+            shift_rows(block_index, local, 1);
+        }
+
+        // Remove every copy of value from a row.  Returns how many there
+        // were.
+        size_t erase(size_t row, index_type value)
+        {
+            auto block_index = row >> block_shift;
+            auto local = row & (block_rows - 1);
+            auto span = (*this)[row];
+            auto range = std::equal_range(span.begin(), span.end(), value);
+            auto count = size_t(range.second - range.first);
+
+            if(count != 0)
+            {
+                auto &b = m_blocks[block_index];
+                auto first = (range.first - b.values) - std::ptrdiff_t(b.offsets[0]);
+                auto &values = write_block(block_index);
+
+                values.erase(
+                    values.begin() + first,
+                    values.begin() + first + std::ptrdiff_t(count));
+
+                m_blocks[block_index].values = values.data();
+                shift_rows(block_index, local, -std::ptrdiff_t(count));
+            }
+
+            return count;
+        }
+
+    private:
+        // A block's offsets and values, kept apart from their owners so
+        // lookups touch a dense table.  Row i of the block is values[offsets[i]]
+        // to values[offsets[i + 1]].
+        struct block
+        {
+            index_type  *offsets;
+            index_type  *values;
+        };
+
+        // Either may be a larger adopted vector the block is a slice of.
+        // A slice's offsets count from the start of the adopted values,
+        // rather than from the block's first value.
+        struct block_owners
+        {
+            std::shared_ptr<index_vector>   offsets;
+            std::shared_ptr<index_vector>   values;
+        };
+
+        // A row in a block changed size by delta.  Move the ends of the
+        // rows after it, and the starts of later blocks.
+        void shift_rows(size_t block_index, size_t local, std::ptrdiff_t delta)
+        {
+            auto offsets = m_blocks[block_index].offsets;
+
+            for(auto i = local + 1; i <= block_rows; ++i)
+            {
+                offsets[i] = index_type(std::ptrdiff_t(offsets[i]) + delta);
+            }
+
+            for(auto i = block_index + 1; i < m_block_starts.size(); ++i)
+            {
+                m_block_starts[i] = size_t(std::ptrdiff_t(m_block_starts[i]) + delta);
+            }
+        }
+
+        // Get a block's values for writing, cloning them and its offsets
+        // if they're shared or slices.  The offsets then count from the
+        // block's first value.
+        index_vector &write_block(size_t block_index)
+        {
+            auto &b = m_blocks[block_index];
+            auto &owners = m_owners[block_index];
+            auto base = b.offsets[0];
+            auto count = b.offsets[block_rows] - base;
+            index_type const *first = b.values + base;
+
+            if((owners.offsets.use_count() != 1) ||
+               (owners.offsets->data() != b.offsets) ||
+               (owners.offsets->size() != block_rows + 1))
+            {
+                auto offsets = std::make_shared<index_vector>(block_rows + 1);
+
+                for(size_t i = 0; i <= block_rows; ++i)
+                {
+                    (*offsets)[i] = b.offsets[i] - base;
+                }
+
+                owners.offsets = offsets;
+                b.offsets = offsets->data();
+            }
+
+            if((owners.values.use_count() != 1) ||
+               (owners.values->data() != first) ||
+               (owners.values->size() != count))
+            {
+                owners.values = std::make_shared<index_vector>(first, first + count);
+            }
+
+            b.values = owners.values->data();
+
+            // The last other owner may have just let go on another
+            // thread; see its reads before writing.
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            return *owners.values;
+        }
+
+        std::vector<block>          m_blocks;
+        std::vector<block_owners>   m_owners;
+
+        // Position of the first value of each block, then the value count.
+        std::vector<size_t>         m_block_starts;
+
+        size_t                      m_row_count;
+    };
+
+    // A read-only range of edges, either stored in order or read off
+    // compressed sparse row adjacency, where row i lists the sources of
+    // the edges into node i.  The latter gives the edges in order of dst
+    // without keeping a second copy of them.
+    //
+    // Edges are given by value, as adjacency doesn't hold edge objects, so
+    // iterators are input iterators.  They can still jump to any position
+    // with +, - and [], and be compared and subtracted.
+    template<typename Edge>
+    class edge_view
+    {
+    public:
+        using value_type    = Edge;
+        using node_id_type  = typename Edge::node_id_type;
+        using edge_array    = chunked_vector<Edge>;
+        using node_id_array = chunked_vector<node_id_type>;
+
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = Edge;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = void;
+            using reference         = Edge;
+
+            const_iterator()
+                : m_rows(nullptr)
+                , m_nodes(nullptr)
+                , m_pos(0)
+                , m_row(0)
+                , m_row_start(0)
+            {
+            }
+
+            const_iterator(edge_view const &view, size_t pos)
+                : m_rows(view.m_rows)
+                , m_nodes(view.m_nodes)
+                , m_pos(0)
+                , m_row(0)
+                , m_row_start(0)
+            {
+                if(view.m_edges)
+                {
+                    m_edge = view.m_edges->begin() + std::ptrdiff_t(pos);
+                    m_pos = pos;
+                }
+                else if(m_rows)
+                {
+                    seek(pos);
+                }
+            }
+
+            reference operator*() const
+            {
+                if(!m_rows)
+                {
+                    return *m_edge;
+                }
+
+                return Edge(
+                    (*m_nodes)[m_sources[m_pos - m_row_start]],
+                    (*m_nodes)[m_row]);
+            }
+
+            reference operator[](difference_type n) const { return *(*this + n); }
+
+            const_iterator &operator++()
+            {
+                ++m_pos;
+
+                if(!m_rows)
+                {
+                    ++m_edge;
+                    return *this;
+                }
+
+                // Step over the rest of this row and any empty ones.
+                while((m_row < m_rows->size()) && (m_pos >= m_row_start + m_sources.size()))
+                {
+                    m_row_start += m_sources.size();
+
+                    if(++m_row < m_rows->size())
+                    {
+                        m_sources = (*m_rows)[m_row];
+                    }
+                }
+
+                return *this;
+            }
+
+            const_iterator &operator--() { return *this -= 1; }
+            const_iterator operator++(int) { auto old = *this; ++*this; return old; }
+            const_iterator operator--(int) { auto old = *this; --*this; return old; }
+
+            const_iterator &operator+=(difference_type n) { seek(m_pos + size_t(n)); return *this; }
+            const_iterator &operator-=(difference_type n) { seek(m_pos - size_t(n)); return *this; }
+
+            const_iterator operator+(difference_type n) const { auto it = *this; return it += n; }
+            const_iterator operator-(difference_type n) const { auto it = *this; return it -= n; }
+
+            friend const_iterator operator+(difference_type n, const_iterator const &it) { return it + n; }
+
+            difference_type operator-(const_iterator const &other) const
+            {
+                return difference_type(m_pos) - difference_type(other.m_pos);
+            }
+
+            bool operator==(const_iterator const &other) const { return m_pos == other.m_pos; }
+            bool operator!=(const_iterator const &other) const { return m_pos != other.m_pos; }
+            bool operator<(const_iterator const &other) const { return m_pos < other.m_pos; }
+            bool operator>(const_iterator const &other) const { return m_pos > other.m_pos; }
+            bool operator<=(const_iterator const &other) const { return m_pos <= other.m_pos; }
+            bool operator>=(const_iterator const &other) const { return m_pos >= other.m_pos; }
+        private:
+            void seek(size_t pos)
+            {
+                if(!m_rows)
+                {
+                    if(pos != m_pos)
+                    {
+                        m_edge += difference_type(pos) - difference_type(m_pos);
+                        m_pos = pos;
+                    }
+
+                    return;
+                }
+
+                m_pos = pos;
+                m_row = m_rows->get_row_of(pos);
+                m_row_start = m_rows->get_row_start(m_row);
+                m_sources = (m_row < m_rows->size()) ?
+                    (*m_rows)[m_row] :
+                    chunked_rows::row_span();
+            }
+
+            typename edge_array::const_iterator m_edge;
+            chunked_rows const                  *m_rows;
+            node_id_array const                 *m_nodes;
+            size_t                              m_pos;
+            size_t                              m_row;
+            size_t                              m_row_start;
+            chunked_rows::row_span              m_sources;
+        };
+
+        edge_view()
+            : m_edges(nullptr)
+            , m_rows(nullptr)
+            , m_nodes(nullptr)
+        {
+        }
+
+        // View edges stored in order.
+        edge_view(edge_array const &edges)
+            : m_edges(&edges)
+            , m_rows(nullptr)
+            , m_nodes(nullptr)
+        {
+        }
+
+        // View the edges into each node in turn.  Row i of rows lists the
+        // sources of the edges into node i, and nodes maps indices to ids.
+        edge_view(chunked_rows const &rows, node_id_array const &nodes)
+            : m_edges(nullptr)
+            , m_rows(&rows)
+            , m_nodes(&nodes)
+        {
+        }
+
+        const_iterator begin() const { return {*this, 0}; }
+        const_iterator end() const { return {*this, size()}; }
+
+        size_t size() const
+        {
+            return m_edges ? m_edges->size() : (m_rows ? m_rows->get_value_count() : 0);
+        }
+
+        bool empty() const { return size() == 0; }
+
+        Edge operator[](size_t i) const { return begin()[std::ptrdiff_t(i)]; }
+        Edge front() const { return (*this)[0]; }
+        Edge back() const { return (*this)[size() - 1]; }
+    private:
+        edge_array const    *m_edges;
+        chunked_rows const  *m_rows;
+        node_id_array const *m_nodes;
+    };
+
+    // Maps the ids in a sorted, unique sequence to their position in it.
+    //
+    // Integer ids packed into a small range use a direct lookup table,
+    // anything else (e.g. sparse 64 bit hashes) uses a hash table.
+    template<typename NodeID>
+    class node_index_map
+    {
+    public:
+        using node_id_type  = NodeID;
+        using index_type    = std::uint32_t;
+
+        static constexpr index_type invalid_index = ~index_type(0);
+
+        node_index_map()
+            : m_table_base()
+            , m_use_table(false)
+        {
+        }
+
+        template<typename Ids>
+        void build(Ids const &sorted_ids)
+        {
+            m_table.clear();
+            m_hash.clear();
+            m_use_table = false;
+
+            build(sorted_ids, std::is_integral<node_id_type>());
+        }
+
+        // Get the index of id, or invalid_index if it isn't present.
+        index_type find(node_id_type id) const
+        {
+            return find(id, std::is_integral<node_id_type>());
+        }
+
+        // Add the last of sorted_ids, which must be larger than all the
+        // others.  Amortised O(1), unless the table would get too sparse
+        // and everything is rebuilt.
+        template<typename Ids>
+        void push_back(Ids const &sorted_ids)
+        {
+            push_back(sorted_ids, std::is_integral<node_id_type>());
+        }
+
+    private:
+        // A table may be up to this many times larger than the id count.
+        static constexpr size_t max_table_spread = 4;
+
+        template<typename Ids>
+        void build(Ids const &sorted_ids, std::true_type)
+        {
+            using key_type = std::make_unsigned_t<node_id_type>;
+
+            if(!sorted_ids.empty())
+            {
+                key_type range =
+                    key_type(sorted_ids.back()) - key_type(sorted_ids.front());
+
+                if(range < max_table_spread * sorted_ids.size())
+                {
+                    m_use_table = true;
+                    m_table_base = sorted_ids.front();
+                    m_table.assign(size_t(range) + 1, invalid_index);
+
+                    for(size_t i = 0; i < sorted_ids.size(); ++i)
+                    {
+                        m_table[size_t(
+                            key_type(sorted_ids[i]) - key_type(m_table_base))] =
+                            index_type(i);
+                    }
+                    return;
+                }
+            }
+
+            build(sorted_ids, std::false_type());
+        }
+
+        template<typename Ids>
+        void build(Ids const &sorted_ids, std::false_type)
+        {
+            m_hash.reserve(sorted_ids.size());
+
+            for(size_t i = 0; i < sorted_ids.size(); ++i)
+            {
+                m_hash.emplace(sorted_ids[i], index_type(i));
+            }
+        }
+
+        template<typename Ids>
+        void push_back(Ids const &sorted_ids, std::true_type)
+        {
+            if(m_use_table)
+            {
+                using key_type = std::make_unsigned_t<node_id_type>;
+
+                auto offset = size_t(
+                    key_type(sorted_ids.back()) - key_type(m_table_base));
+
+                if(offset >= max_table_spread * sorted_ids.size())
+                {
+                    build(sorted_ids);
+                    return;
+                }
+
+                if(offset >= m_table.size())
+                {
+                    m_table.resize(offset + 1, invalid_index);
+                }
+
+                m_table[offset] = index_type(sorted_ids.size() - 1);
+                return;
+            }
+
+            push_back(sorted_ids, std::false_type());
+        }
+
+        template<typename Ids>
+        void push_back(Ids const &sorted_ids, std::false_type)
+        {
+            m_hash.emplace(sorted_ids.back(), index_type(sorted_ids.size() - 1));
+        }
+
+        index_type find(node_id_type id, std::true_type) const
+        {
+            if(m_use_table)
+            {
+                using key_type = std::make_unsigned_t<node_id_type>;
+
+                auto offset = key_type(id) - key_type(m_table_base);
+
+                return (offset < m_table.size()) ?
+                    m_table[size_t(offset)] :
+                    invalid_index;
+            }
+
+            return find(id, std::false_type());
+        }
+
+        index_type find(node_id_type id, std::false_type) const
+        {
+            auto it = m_hash.find(id);
+
+            return (it != m_hash.end()) ? it->second : invalid_index;
+        }
+
+        node_id_type                                m_table_base;
+        bool                                        m_use_table;
+        std::vector<index_type>                     m_table;
+        std::unordered_map<node_id_type, index_type> m_hash;
+    };
+
+    template<typename NodeID>
+    constexpr typename node_index_map<NodeID>::index_type
+        node_index_map<NodeID>::invalid_index;
+
+    template<typename NodeID>
+    constexpr size_t node_index_map<NodeID>::max_table_spread;
+
+    // How a dag stores its edges.
+    enum class edge_storage
+    {
+        // Separate copies of the edges sorted by src and by dst.
+        dual,
+
+        // One copy sorted by src.  Edges by dst are read off the incoming
+        // adjacency, which every dag keeps anyway.  With the adjacency's 4
+        // bytes per edge in each direction, 32 bit ids take 16 bytes per
+        // edge rather than dual storage's 24.  Adopted edge vectors are
+        // always stored this way.
+        single
+    };
+
+    // Which topological order get_sorted_nodes gives.
+    enum class topological_order
+    {
+        // Kahn's algorithm with a FIFO queue.  Single threaded.
+        kahn,
+
+        // All of level 0, then all of level 1 and so on, each level sorted
+        // by id.  Each level is processed in parallel when building with
+        // more than one thread, and the result doesn't depend on the
+        // thread count.
+        level_major
+    };
+
+    // Options controlling how a dag is built.
+    struct dag_options
+    {
+        // Threads to use while building.  1 builds on the calling thread,
+        // 0 uses every hardware thread.
+        unsigned thread_count = 1;
+
+        // How edges are stored.
+        edge_storage storage = edge_storage::dual;
+
+        // Also group nodes into topological levels.  See
+        // dag::get_level_nodes.
+        bool compute_levels = false;
+
+        // Which topological order to sort nodes into.
+        topological_order order = topological_order::kahn;
+    };
+
+    namespace detail
+    {
+        // Ranges shorter than this aren't worth splitting across threads.
+        constexpr size_t min_parallel_sort_size = 1 << 16;
+
+        // Frontiers with fewer edges out of them than this are processed
+        // on one thread by the level-synchronous sort.
+        constexpr size_t min_parallel_frontier_edges = 1 << 14;
+
+        // Resolve a requested thread count, where 0 means "all of them".
+        inline unsigned resolve_thread_count(unsigned requested)
+        {
+            if(requested == 0)
+            {
+                requested = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+
+            return requested;
+        }
+
+        // Ranges shorter than this are comparison sorted even when the key
+        // is an integer, as the radix histograms would dominate.
+        constexpr size_t min_radix_sort_size = 4096;
+
+        // Stable LSD radix sort by an integral key, radix_bits per pass.
+        // Passes where every key has the same digit are skipped, so small
+        // ids in a wide type cost no more than they would in a narrow one.
+        constexpr size_t radix_bits = 11;
+
+        template<typename RandomIt, typename KeyFn>
+        void radix_sort_by_key(RandomIt begin, RandomIt end, KeyFn key)
+        {
+            using value_type    = typename std::iterator_traits<RandomIt>::value_type;
+            using raw_key_type  = std::decay_t<decltype(key(*begin))>;
+            using key_type      = std::make_unsigned_t<raw_key_type>;
+
+            constexpr size_t key_bits   = 8 * sizeof(key_type);
+            constexpr size_t passes     = (key_bits + radix_bits - 1) / radix_bits;
+            constexpr size_t buckets    = size_t(1) << radix_bits;
+            constexpr size_t digit_mask = buckets - 1;
+
+            // Flipping the sign bit makes signed keys order as unsigned.
+            constexpr key_type key_bias = std::is_signed<raw_key_type>::value ?
+                key_type(key_type(1) << (key_bits - 1)) :
+                key_type(0);
+
+            auto count = size_t(end - begin);
+
+            if(count < 2)
+            {
+                return;
+            }
+
+            // Histogram every digit in a single read of the data.
+            std::vector<size_t> histograms(passes * buckets, 0);
+
+            for(auto it = begin; it != end; ++it)
+            {
+                auto k = key_type(key(*it)) ^ key_bias;
+
+                for(size_t pass = 0; pass < passes; ++pass)
+                {
+                    ++histograms[pass * buckets + ((k >> (radix_bits * pass)) & digit_mask)];
+                }
+            }
+
+            std::vector<value_type> scratch(count);
+            auto *src = &*begin;
+            auto *dst = scratch.data();
+
+            for(size_t pass = 0; pass < passes; ++pass)
+            {
+                auto *histogram = &histograms[pass * buckets];
+                auto shift = radix_bits * pass;
+                auto first_key = (key_type(key(*src)) ^ key_bias) >> shift;
+
+                // Nothing to do if every key lands in the same bucket.
+                if(histogram[first_key & digit_mask] == count)
+                {
+                    continue;
+                }
+
+                size_t offset = 0;
+
+                for(size_t bucket = 0; bucket < buckets; ++bucket)
+                {
+                    auto bucket_count = histogram[bucket];
+                    histogram[bucket] = offset;
+                    offset += bucket_count;
+                }
+
+                for(size_t i = 0; i < count; ++i)
+                {
+                    auto k = key_type(key(src[i])) ^ key_bias;
+                    dst[histogram[(k >> shift) & digit_mask]++] = std::move(src[i]);
+                }
+
+                std::swap(src, dst);
+            }
+
+            // An odd number of passes leaves the result in scratch.
+            if(src != &*begin)
+            {
+                std::move(src, src + count, &*begin);
+            }
+        }
+
+        // Comparison sort by key, for keys that can't be radix sorted.
+        template<typename RandomIt, typename KeyFn>
+        void comparison_sort_by_key(RandomIt begin, RandomIt end, KeyFn key)
+        {
+            std::sort(
+                begin,
+                end,
+                [&key](auto &a, auto &b){return key(a) < key(b);});
+        }
+
+        // Stable comparison sort by key.
+        template<typename RandomIt, typename KeyFn>
+        void stable_sort_by_key(RandomIt begin, RandomIt end, KeyFn key)
+        {
+            std::stable_sort(
+                begin,
+                end,
+                [&key](auto &a, auto &b){return key(a) < key(b);});
+        }
+
+        template<typename RandomIt, typename KeyFn>
+        void sort_by_key(RandomIt begin, RandomIt end, KeyFn key, std::true_type)
+        {
+            if(size_t(end - begin) < min_radix_sort_size)
+            {
+                stable_sort_by_key(begin, end, key);
+            }
+            else
+            {
+                radix_sort_by_key(begin, end, key);
+            }
+        }
+
+        template<typename RandomIt, typename KeyFn>
+        void sort_by_key(RandomIt begin, RandomIt end, KeyFn key, std::false_type)
+        {
+            stable_sort_by_key(begin, end, key);
+        }
+
+        // Stable sort by key, choosing a radix sort at compile time when the
+        // key is an integer.
+        template<typename RandomIt, typename KeyFn>
+        void sort_by_key(RandomIt begin, RandomIt end, KeyFn key)
+        {
+            using key_type = std::decay_t<decltype(key(*begin))>;
+
+            sort_by_key(
+                begin,
+                end,
+                key,
+                std::integral_constant<
+                    bool,
+                    std::is_integral<key_type>::value &&
+                    !std::is_same<key_type, bool>::value>());
+        }
+
+        // Stable sort by key using up to thread_count threads.  Equal sized
+        // chunks are sorted concurrently, then neighbouring runs are merged
+        // pairwise, halving the number of runs each round.
+        template<typename RandomIt, typename KeyFn>
+        void parallel_sort_by_key(
+                RandomIt begin,
+                RandomIt end,
+                KeyFn key,
+                unsigned thread_count)
+        {
+            auto count = size_t(end - begin);
+
+            if((thread_count <= 1) || (count < min_parallel_sort_size))
+            {
+                sort_by_key(begin, end, key);
+                return;
+            }
+
+            std::vector<RandomIt> bounds;
+
+            for(size_t i = 0; i <= thread_count; ++i)
+            {
+                bounds.push_back(begin + (count * i) / thread_count);
+            }
+
+            {
+                std::vector<std::thread> threads;
+
+                for(size_t i = 0; i < thread_count; ++i)
+                {
+                    threads.emplace_back(
+                        [&bounds, key, i]
+                        {
+                            sort_by_key(bounds[i], bounds[i + 1], key);
+                        });
+                }
+
+                for(auto &t : threads)
+                {
+                    t.join();
+                }
+            }
+
+            auto comp = [key](auto &a, auto &b){return key(a) < key(b);};
+
+            for(size_t width = 1; width < thread_count; width *= 2)
+            {
+                std::vector<std::thread> threads;
+
+                for(size_t i = 0; i + width < thread_count; i += 2 * width)
+                {
+                    auto first  = bounds[i];
+                    auto middle = bounds[i + width];
+                    auto last   = bounds[std::min<size_t>(i + 2 * width, thread_count)];
+
+                    threads.emplace_back(
+                        [first, middle, last, comp]
+                        {
+                            std::inplace_merge(first, middle, last, comp);
+                        });
+                }
+
+                for(auto &t : threads)
+                {
+                    t.join();
+                }
+            }
+        }
+    }
+
+    template<typename NodeID>
+    class dag
+    {
+    public:
+        using node_id_type      = NodeID;
+        using node_id_vector    = std::vector<node_id_type>;
+        using edge_type         = directed_edge<node_id_type>;
+        using edge_vector       = std::vector<edge_type>;
+        using edge_view_type    = edge_view<edge_type>;
+
+        // Stored arrays are chunked, so that editing a snapshot's copy
+        // clones only the chunks it touches.
+        using node_id_array     = chunked_vector<node_id_type>;
+        using edge_array        = chunked_vector<edge_type>;
+
+        // Nodes are also identified by a dense index, which is their position
+        // in get_all_nodes().  Adjacency is stored in terms of these indices.
+        using index_type        = std::uint32_t;
+        using index_vector      = std::vector<index_type>;
+        using index_array       = chunked_vector<index_type>;
+        using index_span        = const_span<index_type>;
+
+        static constexpr index_type invalid_index =
+            node_index_map<node_id_type>::invalid_index;
+
+        // Construct a DAG given a collection of edges.
+        //
+        // Assumption is that edges order "src" nodes before "dst" nodes.
+        //
+        // vectors are used rather than sets to keep things nicely
+        // laid out in memory.
+        template<typename EdgeIterator>
+        dag(    EdgeIterator edge_begin,
+                EdgeIterator edge_end,
+                std::enable_if_t<
+                    std::is_same<
+                        edge_type,
+                        typename std::iterator_traits<EdgeIterator>::value_type>::value,
+                    int> = 0)
+            : dag(dag_options(), edge_begin, edge_end)
+        {
+        }
+
+        // As above, with options controlling the build.
+        template<typename EdgeIterator>
+        dag(    dag_options const &options,
+                EdgeIterator edge_begin,
+                EdgeIterator edge_end,
+                std::enable_if_t<
+                    std::is_same<
+                        edge_type,
+                        typename std::iterator_traits<EdgeIterator>::value_type>::value,
+                    int> = 0)
+            : m_valid(false)
+            , m_storage(edge_storage::dual)
+        {
+            node_id_vector tmp;
+            build(options, edge_begin, edge_end, tmp.begin(), tmp.end());
+        }
+
+        // Construct a DAG given a collection of edges and nodes.
+        // Nodes that are referenced by edges will be added so the
+        // node iterators may be used to reference orphan nodes not
+        // referenced by any edges.
+        //
+        // Assumption is that edges order "src" nodes before "dst" nodes.
+        //
+        // vectors are used rather than sets to keep things nicely
+        // laid out in memory.
+        template<typename EdgeIterator, typename NodeIterator>
+        dag(
+                EdgeIterator edge_begin,
+                EdgeIterator edge_end,
+                NodeIterator node_begin,
+                NodeIterator node_end,
+                std::enable_if_t<
+                    std::is_same<
+                        edge_type,
+                        typename std::iterator_traits<EdgeIterator>::value_type>::value &&
+                    std::is_same<
+                        node_id_type,
+                        typename std::iterator_traits<NodeIterator>::value_type>::value,
+                    int> = 0)
+            : dag(dag_options(), edge_begin, edge_end, node_begin, node_end)
+        {
+        }
+
+        // As above, with options controlling the build.
+        template<typename EdgeIterator, typename NodeIterator>
+        dag(
+                dag_options const &options,
+                EdgeIterator edge_begin,
+                EdgeIterator edge_end,
+                NodeIterator node_begin,
+                NodeIterator node_end,
+                std::enable_if_t<
+                    std::is_same<
+                        edge_type,
+                        typename std::iterator_traits<EdgeIterator>::value_type>::value &&
+                    std::is_same<
+                        node_id_type,
+                        typename std::iterator_traits<NodeIterator>::value_type>::value,
+                    int> = 0)
+            : m_valid(false)
+            , m_storage(edge_storage::dual)
+        {
+            build(options, edge_begin, edge_end, node_begin, node_end);
+        }
+
+        // Construct a DAG by taking ownership of a vector of edges, which is
+        // sorted in place to become the edges by src.  Edges by dst are read
+        // off the adjacency, so the edges are never copied.
+        //
+        // Assumption is that edges order "src" nodes before "dst" nodes.
+        explicit dag(edge_vector &&edges)
+            : dag(dag_options(), std::move(edges), node_id_vector())
+        {
+        }
+
+        // As above, also taking ownership of a vector of nodes that may
+        // reference orphan nodes not referenced by any edges.
+        dag(edge_vector &&edges, node_id_vector &&nodes)
+            : dag(dag_options(), std::move(edges), std::move(nodes))
+        {
+        }
+
+        // As above, with options controlling the build.
+        dag(dag_options const &options, edge_vector &&edges)
+            : dag(options, std::move(edges), node_id_vector())
+        {
+        }
+
+        // As above, with options controlling the build.
+        dag(dag_options const &options, edge_vector &&edges, node_id_vector &&nodes)
+            : m_valid(false)
+            , m_storage(edge_storage::dual)
+        {
+            adopt(options, std::move(edges), std::move(nodes));
+        }
+
+        // Is this in a valid state.  Will return false if the input was not
+        // a DAG.
+        bool get_valid() const { return m_valid; }
+
+        // Get an immutable copy of this version of the graph.  O(1).
+        //
+        // Copies of a dag share their arrays until one of them is edited.
+        // The arrays are stored in chunks, and an edit clones only the
+        // chunks it writes to, along with each changed array's table of
+        // chunks, O(V / 1024 + E / 4096) entries.  Adding a node also
+        // clones the id to index map, and edits that renumber nodes or
+        // rebuild the adjacency rewrite whole arrays anyway.  So a
+        // snapshot may be read from other threads while this dag is
+        // edited, though taking one is not itself safe during an edit.
+        //
+        // The accessors returning vectors copy them out of the chunks the
+        // first time they are called after an edit, O(V) or O(E), and
+        // keep them until the next one.  Queries and edits work on the
+        // chunks directly.
+        dag snapshot() const
+        {
+            return *this;
+        }
+
+        // Get all nodes, sorted by id.
+        node_id_vector const &get_all_nodes() const
+        {
+             return m_all_nodes->get_contiguous();
+        }
+
+        // Get nodes in topological order.  Will be empty if this is not a DAG.
+        node_id_vector const &get_sorted_nodes() const
+        {
+             return m_sorted_nodes->get_contiguous();
+        }
+
+        // Get edges sorted by src id.
+        edge_vector const &get_edges_by_src() const
+        {
+            return m_edges_by_src->get_contiguous();
+        }
+
+        // Number of nodes.  O(1), without copying them out.
+        size_t get_node_count() const
+        {
+            return m_all_nodes.size();
+        }
+
+        // Number of edges, counting duplicates.  O(1), without copying
+        // them out.
+        size_t get_edge_count() const
+        {
+            return m_edges_by_src.size();
+        }
+
+        // How this dag stores its edges.
+        edge_storage get_edge_storage() const
+        {
+            return m_storage;
+        }
+
+        // Get edges sorted by dst id, and by src within a dst.  With
+        // single edge storage there is no such array, so the edges are
+        // copied off the adjacency on the first call after an edit, O(E),
+        // and kept until the next.
+        edge_vector const &get_edges_by_dst() const
+        {
+            if(m_storage == edge_storage::dual)
+            {
+                return m_edges_by_dst->get_contiguous();
+            }
+
+            return m_single_by_dst.get(
+                [this](edge_vector &edges)
+                {
+                    auto &rows = m_in_rows.get();
+
+                    edges.reserve(rows.get_value_count());
+
+                    for(size_t dst = 0; dst < rows.size(); ++dst)
+                    {
+                        for(auto src : rows[dst])
+                        {
+                            edges.emplace_back(m_all_nodes[src], m_all_nodes[dst]);
+                        }
+                    }
+                });
+        }
+
+        // View the edges in get_edges_by_dst() order, given by value.  With
+        // single edge storage they are read off the adjacency, without
+        // the copy get_edges_by_dst() makes.
+        edge_view_type get_edges_by_dst_view() const
+        {
+            if(m_storage == edge_storage::dual)
+            {
+                return edge_view_type(m_edges_by_dst.get());
+            }
+
+            return edge_view_type(m_in_rows.get(), m_all_nodes.get());
+        }
+
+        // Get the dense index of a node, or invalid_index if the node is not
+        // in the graph.  O(1).
+        index_type index_of(node_id_type id) const
+        {
+            return m_index_map->find(id);
+        }
+
+        // Get the id of the node with the given dense index.  O(1).
+        node_id_type id_of(index_type index) const
+        {
+            return m_all_nodes[index];
+        }
+
+        // Get indices of nodes that have edges leading directly from this
+        // node.  Sorted by index (and so by id), duplicate edges are kept.
+        index_span get_successors(index_type index) const
+        {
+            return m_out_rows.get()[index];
+        }
+
+        // Get indices of nodes that have edges leading directly to this
+        // node.  Sorted by index (and so by id), duplicate edges are kept.
+        index_span get_predecessors(index_type index) const
+        {
+            return m_in_rows.get()[index];
+        }
+
+        // Get indices of nodes with no edges leading to them, in index
+        // order.
+        index_vector const &get_root_indices() const
+        {
+            return m_roots->get_contiguous();
+        }
+
+        // Get the position of a node in get_sorted_nodes().  Every edge
+        // leads from a lower rank to a higher one.  Only valid for a DAG.
+        index_type get_rank(index_type index) const
+        {
+            return m_ranks[index];
+        }
+
+        // Get the position of a node in get_sorted_nodes(), or
+        // invalid_index if it isn't in the graph or this isn't a DAG.
+        // O(1).  If a reaches b, rank_of(a) < rank_of(b).
+        index_type rank_of(node_id_type id) const
+        {
+            auto index = index_of(id);
+
+            if(!m_valid || (index == invalid_index))
+            {
+                return invalid_index;
+            }
+
+            return m_ranks[index];
+        }
+
+        // Get the node at a position in get_sorted_nodes().  O(1).
+        node_id_type node_at_rank(index_type rank) const
+        {
+            return m_sorted_nodes[rank];
+        }
+
+        // Were topological levels computed?  Only if asked for in the
+        // options and this is a DAG.  Editing the graph discards them.
+        bool get_has_levels() const
+        {
+            return !m_level_offsets.empty();
+        }
+
+        // Number of topological levels, or 0 if they weren't computed.
+        size_t get_level_count() const
+        {
+            return m_level_offsets.empty() ? 0 : m_level_offsets.size() - 1;
+        }
+
+        // Get the level of a node: the length of the longest path to it
+        // from a root, so roots are level 0 and every edge leads to a
+        // higher level.  Nodes within a level are independent.
+        //
+        // invalid_index if levels weren't computed, or were discarded by
+        // an edit, or the index is out of range.
+        index_type get_level(index_type index) const
+        {
+            if(!get_has_levels() || (index >= m_levels.size()))
+            {
+                return invalid_index;
+            }
+
+            return m_levels[index];
+        }
+
+        // Get indices of the nodes in a level, sorted by index (and so by
+        // id).  Empty if level isn't below get_level_count().
+        index_span get_level_nodes(size_t level) const
+        {
+            if(level >= get_level_count())
+            {
+                return {nullptr, nullptr};
+            }
+
+            return {
+                m_level_nodes.data() + m_level_offsets[level],
+                m_level_nodes.data() + m_level_offsets[level + 1]};
+        }
+
+        // Recompute the topological order from scratch, in the order and
+        // with the levels and threads options asks for; its storage is
+        // ignored.  Brings back levels discarded by an edit.  O(V + E).
+        // Returns get_valid().
+        bool resort(dag_options const &options)
+        {
+            sort_nodes(options, detail::resolve_thread_count(options.thread_count));
+            return m_valid;
+        }
+
+        // Editing.  These keep every view of the graph up to date, and keep
+        // get_sorted_nodes() a topological order, though not necessarily
+        // the one construction would give.  Only a valid DAG can be edited.
+
+        // Add a node with no edges, last in the topological order.  Returns
+        // false if it is already present or this isn't a DAG.
+        //
+        // Node indices are positions in get_all_nodes(), so adding an id
+        // below the largest shifts every index above it, which is O(V + E).
+        // Adding ids in increasing order is amortised O(1).
+        bool add_node(node_id_type id)
+        {
+            if(!m_valid || (index_of(id) != invalid_index))
+            {
+                return false;
+            }
+
+            discard_derived();
+
+            auto pos = std::lower_bound(m_all_nodes.begin(), m_all_nodes.end(), id);
+
+            if(pos == m_all_nodes.end())
+            {
+                auto index = index_type(m_all_nodes.size());
+
+                m_all_nodes.write().push_back(id);
+                m_index_map.write().push_back(m_all_nodes.get());
+
+                m_out_rows.write().push_row();
+                m_in_rows.write().push_row();
+                m_ranks.write().push_back(index_type(m_sorted_nodes.size()));
+                m_sorted_nodes.write().push_back(id);
+                m_roots.write().push_back(index);
+            }
+            else
+            {
+                insert_node(index_type(pos - m_all_nodes.begin()), id);
+            }
+
+            return true;
+        }
+
+        // Add an edge, and any of its nodes not already present.  Returns
+        // false, changing nothing, if it would make a cycle or this isn't a
+        // DAG.  Duplicate edges are kept, as in construction.
+        //
+        // The topological order is kept with the Pearce-Kelly algorithm,
+        // which only reorders the nodes ranked between dst and src, and
+        // only if the edge goes against the current order.
+        //
+        // Storing the edge inserts it into one chunk of each sorted edge
+        // array and one block of rows in each direction of the adjacency,
+        // then moves the starts of the chunks and blocks after those.  So
+        // each call is O(V / 1024 + E / 4096), plus a search for the edge's
+        // place; batches of edits are still better made with apply_delta.
+        bool add_edge(node_id_type src, node_id_type dst)
+        {
+            if(!m_valid || (src == dst))
+            {
+                return false;
+            }
+
+            // A new node has no path to or from anything yet, so can't be
+            // part of a cycle.  That means adding nodes here never has to
+            // be undone.
+            add_node(src);
+            add_node(dst);
+
+            auto src_index = index_of(src);
+            auto dst_index = index_of(dst);
+
+            if((m_ranks[src_index] > m_ranks[dst_index]) &&
+               !reorder(src_index, dst_index))
+            {
+                return false;
+            }
+
+            insert_edge(edge_type(src, dst), src_index, dst_index);
+            return true;
+        }
+
+        // Remove every copy of an edge.  Returns false if there were none
+        // or this isn't a DAG.  Removing edges never breaks a topological
+        // order, so ranks are unchanged.
+        //
+        // Only the edges sharing src, and those sharing dst, are searched,
+        // and only the chunks holding them are rewritten.
+        bool remove_edge(node_id_type src, node_id_type dst)
+        {
+            auto src_index = index_of(src);
+            auto dst_index = index_of(dst);
+
+            if(!m_valid ||
+               (src_index == invalid_index) ||
+               (dst_index == invalid_index))
+            {
+                return false;
+            }
+
+            edge_type edge(src, dst);
+
+            if(erase_edge(m_edges_by_src, edge, false) == 0)
+            {
+                return false;
+            }
+
+            if(m_storage == edge_storage::dual)
+            {
+                erase_edge(m_edges_by_dst, edge, true);
+            }
+
+            discard_derived();
+
+            m_out_rows.write().erase(src_index, dst_index);
+            m_in_rows.write().erase(dst_index, src_index);
+
+            if(get_predecessors(dst_index).empty())
+            {
+                auto pos = std::lower_bound(m_roots.begin(), m_roots.end(), dst_index);
+
+                m_roots.write().insert(size_t(pos - m_roots.begin()), dst_index);
+            }
+
+            return true;
+        }
+
+        // Remove every copy of each of a collection of edges, compacting
+        // everything once.  Only the k edges are sorted; the edge vectors
+        // and adjacency rows are compacted in linear passes, as in
+        // apply_delta, so this is O(V + E + k log k).  Returns how many
+        // edges were removed.
+        template<typename EdgeIterator>
+        size_t remove_edges(EdgeIterator edge_begin, EdgeIterator edge_end)
+        {
+            if(!m_valid)
+            {
+                return 0;
+            }
+
+            std::vector<id_pair> removed_by_src, removed_by_dst;
+            std::vector<index_pair> removed_out, removed_in;
+
+            for(auto it = edge_begin; it != edge_end; ++it)
+            {
+                auto src = index_of(it->get_src());
+                auto dst = index_of(it->get_dst());
+
+                if((src != invalid_index) && (dst != invalid_index))
+                {
+                    removed_by_src.emplace_back(it->get_src(), it->get_dst());
+                    removed_by_dst.emplace_back(it->get_dst(), it->get_src());
+                    removed_out.emplace_back(src, dst);
+                    removed_in.emplace_back(dst, src);
+                }
+            }
+
+            std::sort(removed_by_src.begin(), removed_by_src.end());
+
+            auto removed = erase_listed_edges(m_edges_by_src, removed_by_src, false);
+
+            if(removed == 0)
+            {
+                return 0;
+            }
+
+            if(m_storage == edge_storage::dual)
+            {
+                std::sort(removed_by_dst.begin(), removed_by_dst.end());
+                erase_listed_edges(m_edges_by_dst, removed_by_dst, true);
+            }
+
+            std::sort(removed_out.begin(), removed_out.end());
+            std::sort(removed_in.begin(), removed_in.end());
+
+            discard_derived();
+
+            // Indices don't change.
+            index_vector identity(m_all_nodes.size());
+            std::iota(identity.begin(), identity.end(), index_type(0));
+
+            compact_rows(m_out_rows, identity, identity, removed_out);
+            compact_rows(m_in_rows, identity, identity, removed_in);
+
+            find_roots();
+
+            return removed;
+        }
+
+        // Remove a node and its edges.  Returns false if it isn't present
+        // or this isn't a DAG.  The rest of the topological order stays as
+        // it was.  O(V + E), as node indices above it shift down.
+        bool remove_node(node_id_type id)
+        {
+            return remove_nodes(&id, &id + 1) != 0;
+        }
+
+        // Remove a collection of nodes and their edges, compacting
+        // everything once.  Returns how many nodes were removed.
+        template<typename NodeIterator>
+        size_t remove_nodes(NodeIterator node_begin, NodeIterator node_end)
+        {
+            if(!m_valid)
+            {
+                return 0;
+            }
+
+            auto node_count = m_all_nodes.size();
+            std::vector<std::uint8_t> dead(node_count, 0);
+            size_t removed = 0;
+
+            for(auto it = node_begin; it != node_end; ++it)
+            {
+                auto index = index_of(*it);
+
+                if((index != invalid_index) && !dead[index])
+                {
+                    dead[index] = 1;
+                    ++removed;
+                }
+            }
+
+            if(removed == 0)
+            {
+                return 0;
+            }
+
+            discard_derived();
+
+            // Everything below still uses the old indices until the map is
+            // rebuilt.
+            erase_edges_if(
+                [this, &dead](edge_type const &edge)
+                {
+                    return
+                        dead[index_of(edge.get_src())] ||
+                        dead[index_of(edge.get_dst())];
+                });
+
+            // Node arrays are rebuilt whole, as every index above the
+            // first dead node shifts.
+            node_id_vector sorted, all;
+
+            for(auto id : m_sorted_nodes)
+            {
+                if(!dead[index_of(id)])
+                {
+                    sorted.push_back(id);
+                }
+            }
+
+            for(auto id : m_all_nodes)
+            {
+                if(!dead[index_of(id)])
+                {
+                    all.push_back(id);
+                }
+            }
+
+            m_all_nodes.replace().assign(std::move(all));
+            m_index_map.write().build(m_all_nodes.get());
+
+            index_vector ranks(sorted.size());
+
+            for(size_t i = 0; i < sorted.size(); ++i)
+            {
+                ranks[index_of(sorted[i])] = index_type(i);
+            }
+
+            m_sorted_nodes.replace().assign(std::move(sorted));
+            m_ranks.replace().assign(std::move(ranks));
+
+            // Surviving indices shift down past the dead ones, which keeps
+            // rows sorted.  Rows of, and entries for, dead nodes go.
+            index_vector remap(node_count, invalid_index);
+            index_vector old_of_new;
+
+            old_of_new.reserve(m_all_nodes.size());
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                if(!dead[i])
+                {
+                    remap[i] = index_type(old_of_new.size());
+                    old_of_new.push_back(index_type(i));
+                }
+            }
+
+            compact_rows(m_out_rows, remap, old_of_new, {});
+            compact_rows(m_in_rows, remap, old_of_new, {});
+
+            find_roots();
+
+            return removed;
+        }
+
+        // Apply a batch of edits at once: remove every copy of each edge in
+        // removed, then add the edges in added along with any new nodes.
+        // Returns false, changing nothing, if the result would have a cycle
+        // or this isn't a DAG.
+        //
+        // Only the delta is sorted.  It is merged into the existing edge
+        // vectors and adjacency rows in linear passes, and the topological
+        // order is only recomputed between the lowest and highest ranks
+        // spanned by added edges that go against it.  The new version is
+        // built alongside the current one, so it can be dropped on failure.
+        bool apply_delta(edge_vector const &added, edge_vector const &removed)
+        {
+            if(!m_valid)
+            {
+                return false;
+            }
+
+            std::vector<id_pair> removed_by_src, removed_by_dst;
+            std::vector<index_pair> removed_out, removed_in;
+
+            for(auto &edge : removed)
+            {
+                removed_by_src.emplace_back(edge.get_src(), edge.get_dst());
+                removed_by_dst.emplace_back(edge.get_dst(), edge.get_src());
+
+                auto src = index_of(edge.get_src());
+                auto dst = index_of(edge.get_dst());
+
+                if((src != invalid_index) && (dst != invalid_index))
+                {
+                    removed_out.emplace_back(src, dst);
+                    removed_in.emplace_back(dst, src);
+                }
+            }
+
+            std::sort(removed_by_src.begin(), removed_by_src.end());
+            std::sort(removed_by_dst.begin(), removed_by_dst.end());
+
+            auto src_less = [](edge_type const &a, edge_type const &b)
+            {
+                return a.get_src() < b.get_src();
+            };
+
+            auto dst_less = [](edge_type const &a, edge_type const &b)
+            {
+                return a.get_dst() < b.get_dst();
+            };
+
+            edge_vector added_by_src(added);
+            std::stable_sort(added_by_src.begin(), added_by_src.end(), src_less);
+
+            // Nodes not seen before go last in the topological order.
+            node_id_vector new_nodes;
+
+            for(auto &edge : added)
+            {
+                for(auto id : {edge.get_src(), edge.get_dst()})
+                {
+                    if(index_of(id) == invalid_index)
+                    {
+                        new_nodes.push_back(id);
+                    }
+                }
+            }
+
+            std::sort(new_nodes.begin(), new_nodes.end());
+            new_nodes.erase(
+                std::unique(new_nodes.begin(), new_nodes.end()),
+                new_nodes.end());
+
+            dag next;
+
+            next.m_valid = true;
+            next.m_storage = m_storage;
+
+            // Each array of next is built whole, then adopted.
+            node_id_vector next_nodes(m_all_nodes.size() + new_nodes.size());
+
+            std::merge(
+                m_all_nodes.begin(), m_all_nodes.end(),
+                new_nodes.begin(), new_nodes.end(),
+                next_nodes.begin());
+
+            next.m_index_map.write().build(next_nodes);
+
+            // Merge edges by src, existing edges first within a src.
+            {
+                edge_vector next_by_src;
+                next_by_src.reserve(m_edges_by_src.size() + added.size());
+
+                auto is_removed_by_src = removal_walker(removed_by_src);
+                auto it = m_edges_by_src.begin(), end = m_edges_by_src.end();
+
+                for(size_t j = 0; (it != end) || (j != added_by_src.size());)
+                {
+                    if((j == added_by_src.size()) ||
+                       ((it != end) && !src_less(added_by_src[j], *it)))
+                    {
+                        auto &edge = *it++;
+
+                        if(!is_removed_by_src(edge.get_src(), edge.get_dst()))
+                        {
+                            next_by_src.push_back(edge);
+                        }
+                    }
+                    else
+                    {
+                        next_by_src.push_back(added_by_src[j++]);
+                    }
+                }
+
+                next.m_edges_by_src.write().assign(std::move(next_by_src));
+            }
+
+            if(m_storage == edge_storage::dual)
+            {
+                edge_vector added_by_dst(added);
+                std::stable_sort(added_by_dst.begin(), added_by_dst.end(), dst_less);
+
+                auto is_removed_by_dst = removal_walker(removed_by_dst);
+
+                edge_vector next_by_dst;
+                next_by_dst.reserve(m_edges_by_dst.size() + added.size());
+
+                auto it = m_edges_by_dst.begin(), end = m_edges_by_dst.end();
+
+                for(size_t j = 0; (it != end) || (j != added_by_dst.size());)
+                {
+                    if((j == added_by_dst.size()) ||
+                       ((it != end) && !dst_less(added_by_dst[j], *it)))
+                    {
+                        auto &edge = *it++;
+
+                        if(!is_removed_by_dst(edge.get_dst(), edge.get_src()))
+                        {
+                            next_by_dst.push_back(edge);
+                        }
+                    }
+                    else
+                    {
+                        next_by_dst.push_back(added_by_dst[j++]);
+                    }
+                }
+
+                next.m_edges_by_dst.write().assign(std::move(next_by_dst));
+            }
+
+            // Old indices move up past the new nodes sorted before them,
+            // which keeps their order, so adjacency rows stay sorted.
+            index_vector remap(m_all_nodes.size());
+            index_vector old_of_new(next_nodes.size(), invalid_index);
+
+            {
+                size_t i = 0, j = 0;
+
+                for(auto id : m_all_nodes)
+                {
+                    while((j != new_nodes.size()) && (new_nodes[j] < id))
+                    {
+                        ++j;
+                    }
+
+                    remap[i] = index_type(i + j);
+                    old_of_new[i + j] = index_type(i);
+                    ++i;
+                }
+            }
+
+            std::vector<index_pair> added_out, added_in;
+
+            for(auto &edge : added)
+            {
+                auto src = next.index_of(edge.get_src());
+                auto dst = next.index_of(edge.get_dst());
+
+                added_out.emplace_back(src, dst);
+                added_in.emplace_back(dst, src);
+            }
+
+            for(auto *pairs : {&removed_out, &removed_in, &added_out, &added_in})
+            {
+                std::sort(pairs->begin(), pairs->end());
+            }
+
+            {
+                index_vector offsets, values;
+
+                merge_rows(
+                    m_out_rows.get(), remap, old_of_new,
+                    removed_out, added_out,
+                    offsets, values);
+
+                next.m_out_rows.write().assign(std::move(offsets), std::move(values));
+            }
+
+            {
+                index_vector offsets, values;
+
+                merge_rows(
+                    m_in_rows.get(), remap, old_of_new,
+                    removed_in, added_in,
+                    offsets, values);
+
+                next.m_in_rows.write().assign(std::move(offsets), std::move(values));
+            }
+
+            // Removing edges keeps the old order valid, so start from it
+            // with the new nodes appended.
+            node_id_vector next_sorted;
+
+            next_sorted.reserve(next_nodes.size());
+            next_sorted.assign(m_sorted_nodes.begin(), m_sorted_nodes.end());
+            next_sorted.insert(
+                next_sorted.end(), new_nodes.begin(), new_nodes.end());
+
+            index_vector next_ranks(next_nodes.size());
+
+            for(index_type i = 0, new_rank = index_type(m_all_nodes.size());
+                i != next_nodes.size();
+                ++i)
+            {
+                next_ranks[i] =
+                    (old_of_new[i] != invalid_index) ?
+                    m_ranks[old_of_new[i]] :
+                    new_rank++;
+            }
+
+            // Find the span of ranks that added edges put out of order.
+            auto lower = invalid_index, upper = index_type(0);
+
+            for(auto &pair : added_out)
+            {
+                auto src_rank = next_ranks[pair.first];
+                auto dst_rank = next_ranks[pair.second];
+
+                if(src_rank >= dst_rank)
+                {
+                    lower = std::min(lower, dst_rank);
+                    upper = std::max(upper, src_rank);
+                }
+            }
+
+            if((lower != invalid_index) &&
+               !next.sort_ranks(lower, upper, next_nodes, next_ranks, next_sorted))
+            {
+                return false;
+            }
+
+            next.m_all_nodes.write().assign(std::move(next_nodes));
+            next.m_sorted_nodes.write().assign(std::move(next_sorted));
+            next.m_ranks.write().assign(std::move(next_ranks));
+
+            next.find_roots();
+
+            *this = std::move(next);
+            return true;
+        }
+
+    private:
+        using index_pair    = std::pair<index_type, index_type>;
+        using id_pair       = std::pair<node_id_type, node_id_type>;
+
+        // Storage is copy on write, so copies of a dag share it until one
+        // of them is edited.  Chunked arrays are then shared chunk by
+        // chunk.  See snapshot().
+        template<typename T>
+        using shared = copy_on_write<T>;
+
+        // For building into.
+        dag()
+            : m_valid(false)
+            , m_storage(edge_storage::dual)
+        {
+        }
+
+        // Construction helpers.
+
+        // Construct a DAG given a collection of edges and nodes.
+        //
+        // The two edge sorts and the node gathering are independent, so
+        // with more than one thread they run concurrently, each sorting
+        // with its share of the threads.  Integer ids are radix sorted.
+        template<typename EdgeIterator, typename NodeIterator>
+        void build(
+                dag_options const &options,
+                EdgeIterator edge_begin,
+                EdgeIterator edge_end,
+                NodeIterator node_begin,
+                NodeIterator node_end)
+        {
+            auto thread_count = detail::resolve_thread_count(options.thread_count);
+            auto task_threads = std::max(thread_count / 3, 1u);
+
+            m_storage = options.storage;
+
+            // Set up edge vectors.  They are sorted, then adopted by the
+            // chunked arrays without copying.
+            edge_vector by_src(edge_begin, edge_end), by_dst;
+
+            if(m_storage == edge_storage::dual)
+            {
+                by_dst = by_src;
+            }
+
+            auto sort_by_src = [this, &by_src, task_threads]
+            {
+                detail::parallel_sort_by_key(
+                    by_src.begin(),
+                    by_src.end(),
+                    [](auto &edge){return edge.get_src();},
+                    task_threads);
+
+                m_edges_by_src.write().assign(std::move(by_src));
+            };
+
+            auto sort_by_dst = [this, &by_dst, task_threads]
+            {
+                if(m_storage == edge_storage::single)
+                {
+                    return;
+                }
+
+                detail::parallel_sort_by_key(
+                    by_dst.begin(),
+                    by_dst.end(),
+                    [](auto &edge){return edge.get_dst();},
+                    task_threads);
+
+                m_edges_by_dst.write().assign(std::move(by_dst));
+            };
+
+            // gather nodes.
+            auto gather_nodes = [&, task_threads]
+            {
+                node_id_vector all_nodes(node_begin, node_end);
+
+                std::for_each(
+                    edge_begin,
+                    edge_end,
+                    [&all_nodes](auto &edge)
+                    {
+                        all_nodes.push_back(edge.get_src());
+                        all_nodes.push_back(edge.get_dst());
+                    });
+
+                // Sort and apply uniqueness criterion
+                detail::parallel_sort_by_key(
+                    all_nodes.begin(),
+                    all_nodes.end(),
+                    [](node_id_type id){return id;},
+                    task_threads);
+
+                all_nodes.erase(
+                    std::unique(all_nodes.begin(), all_nodes.end()),
+                    all_nodes.end());
+
+                m_all_nodes.write().assign(std::move(all_nodes));
+            };
+
+            if(thread_count > 1)
+            {
+                std::thread src_thread(sort_by_src), dst_thread(sort_by_dst);
+
+                gather_nodes();
+
+                src_thread.join();
+                dst_thread.join();
+            }
+            else
+            {
+                sort_by_src();
+                sort_by_dst();
+                gather_nodes();
+            }
+
+            m_index_map.write().build(m_all_nodes.get());
+            build_adjacency();
+            sort_nodes(options, thread_count);
+        }
+
+        // Construct a DAG from an adopted edge vector, keeping peak memory
+        // down to the edges plus a few index arrays.  The edges are sorted
+        // in place with a comparison sort, as a radix sort would need a
+        // second copy of them as scratch space.
+        void adopt(
+                dag_options const &options,
+                edge_vector &&edges,
+                node_id_vector &&nodes)
+        {
+            auto thread_count = detail::resolve_thread_count(options.thread_count);
+
+            m_storage = edge_storage::single;
+
+            detail::comparison_sort_by_key(
+                edges.begin(),
+                edges.end(),
+                [](auto &edge){return edge.get_src();});
+
+            // gather nodes.  Edges are sorted by src, so only the first of
+            // each run of equal srcs is needed.
+            {
+                node_id_vector all_nodes = std::move(nodes);
+
+                for(size_t i = 0; i < edges.size(); ++i)
+                {
+                    auto src = edges[i].get_src();
+
+                    if((i == 0) || (src != edges[i - 1].get_src()))
+                    {
+                        all_nodes.push_back(src);
+                    }
+
+                    all_nodes.push_back(edges[i].get_dst());
+                }
+
+                // Sort and apply uniqueness criterion
+                detail::parallel_sort_by_key(
+                    all_nodes.begin(),
+                    all_nodes.end(),
+                    [](node_id_type id){return id;},
+                    thread_count);
+
+                all_nodes.erase(
+                    std::unique(all_nodes.begin(), all_nodes.end()),
+                    all_nodes.end());
+
+                all_nodes.shrink_to_fit();
+                m_all_nodes.write().assign(std::move(all_nodes));
+            }
+
+            // Adopted whole, so the edges are never copied.
+            m_edges_by_src.write().assign(std::move(edges));
+
+            m_index_map.write().build(m_all_nodes.get());
+            build_adjacency();
+            sort_nodes(options, thread_count);
+        }
+
+        // Build compressed sparse row adjacency in both directions, so a
+        // node's neighbours are a contiguous run found in O(1).
+        void build_adjacency()
+        {
+            auto node_count = m_all_nodes.size();
+            auto &edges = m_edges_by_src.get();
+
+            index_vector out_offsets(node_count + 1, 0);
+            index_vector in_offsets(node_count + 1, 0);
+
+            index_vector out_targets(edges.size());
+            index_vector in_sources(edges.size());
+
+            // Count edges per node, then turn counts into row offsets.
+            for(auto &edge : edges)
+            {
+                ++out_offsets[index_of(edge.get_src()) + 1];
+                ++in_offsets[index_of(edge.get_dst()) + 1];
+            }
+
+            std::partial_sum(
+                out_offsets.begin(),
+                out_offsets.end(),
+                out_offsets.begin());
+
+            std::partial_sum(
+                in_offsets.begin(),
+                in_offsets.end(),
+                in_offsets.begin());
+
+            // Fill rows.  Walking the edges in order of the opposite end
+            // leaves every row sorted: the incoming rows from the edges by
+            // src, then the outgoing rows from the incoming ones.
+            {
+                index_vector in_pos(in_offsets.begin(), in_offsets.end() - 1);
+
+                for(auto &edge : edges)
+                {
+                    auto dst = index_of(edge.get_dst());
+                    in_sources[in_pos[dst]++] = index_of(edge.get_src());
+                }
+            }
+
+            {
+                index_vector out_pos(out_offsets.begin(), out_offsets.end() - 1);
+
+                for(size_t dst = 0; dst < node_count; ++dst)
+                {
+                    for(auto i = in_offsets[dst]; i != in_offsets[dst + 1]; ++i)
+                    {
+                        out_targets[out_pos[in_sources[i]]++] = index_type(dst);
+                    }
+                }
+            }
+
+            m_out_rows.replace().assign(std::move(out_offsets), std::move(out_targets));
+            m_in_rows.replace().assign(std::move(in_offsets), std::move(in_sources));
+        }
+
+        // Build adjacency rows over a new index space from old rows.  Old
+        // indices map through remap, pairs in removed (old indices) are
+        // dropped and pairs in added (new indices) are merged in.  Both
+        // lists are sorted, so this is one pass over the rows.  Values
+        // whose remap is invalid_index are dropped too.
+        static void merge_rows(
+                chunked_rows const              &rows,
+                index_vector const              &remap,
+                index_vector const              &old_of_new,
+                std::vector<index_pair> const   &removed,
+                std::vector<index_pair> const   &added,
+                index_vector                    &new_offsets,
+                index_vector                    &new_values)
+        {
+            auto row_count = old_of_new.size();
+
+            new_offsets.resize(row_count + 1);
+            new_offsets[0] = 0;
+
+            new_values.clear();
+            new_values.reserve(rows.get_value_count() + added.size());
+
+            size_t removed_pos = 0, added_pos = 0;
+
+            for(index_type row = 0; row != row_count; ++row)
+            {
+                auto old = old_of_new[row];
+
+                if(old != invalid_index)
+                {
+                    for(auto old_value : rows[old])
+                    {
+                        index_pair key(old, old_value);
+
+                        while((removed_pos != removed.size()) && (removed[removed_pos] < key))
+                        {
+                            ++removed_pos;
+                        }
+
+                        if((removed_pos != removed.size()) && (removed[removed_pos] == key))
+                        {
+                            continue;
+                        }
+
+                        auto value = remap[old_value];
+
+                        if(value == invalid_index)
+                        {
+                            continue;
+                        }
+
+                        while((added_pos != added.size()) &&
+                              (added[added_pos].first == row) &&
+                              (added[added_pos].second < value))
+                        {
+                            new_values.push_back(added[added_pos++].second);
+                        }
+
+                        new_values.push_back(value);
+                    }
+                }
+
+                while((added_pos != added.size()) && (added[added_pos].first == row))
+                {
+                    new_values.push_back(added[added_pos++].second);
+                }
+
+                new_offsets[row + 1] = index_type(new_values.size());
+            }
+        }
+
+        // merge_rows in place, with nothing added.
+        static void compact_rows(
+                shared<chunked_rows>            &rows,
+                index_vector const              &remap,
+                index_vector const              &old_of_new,
+                std::vector<index_pair> const   &removed)
+        {
+            index_vector new_offsets, new_values;
+
+            merge_rows(
+                rows.get(), remap, old_of_new, removed, {},
+                new_offsets, new_values);
+
+            rows.replace().assign(std::move(new_offsets), std::move(new_values));
+        }
+
+        // Tests edges, visited in order of their first end, against keys
+        // sorted the same way.  Only edges whose first end has removals get
+        // as far as a search.
+        static auto removal_walker(std::vector<id_pair> const &keys)
+        {
+            size_t pos = 0;
+
+            return [&keys, pos](node_id_type first, node_id_type second) mutable
+            {
+                while((pos != keys.size()) && (keys[pos].first < first))
+                {
+                    ++pos;
+                }
+
+                return
+                    (pos != keys.size()) &&
+                    !(first < keys[pos].first) &&
+                    std::binary_search(
+                        keys.begin() + pos,
+                        keys.end(),
+                        id_pair(first, second));
+            };
+        }
+
+        // Sort into the topological order asked for, if possible.
+        void sort_nodes(dag_options const &options, unsigned thread_count)
+        {
+            if(options.order == topological_order::level_major)
+            {
+                level_sort(options.compute_levels, thread_count);
+            }
+            else
+            {
+                topological_sort(options.compute_levels);
+            }
+        }
+
+        // Sort into topological order if possible, using Kahn's algorithm.
+        //
+        // O(V + E): in-degrees come straight from the CSR offsets and
+        // every node is queued exactly once, when its in-degree reaches
+        // zero, so one flat buffer of node_count entries serves as the
+        // queue and ends up holding the sorted order.
+        //
+        // A node is only queued after all its predecessors, so its level
+        // is final by then and levels cost one more pass over the edges.
+        void topological_sort(bool compute_levels)
+        {
+            m_sorted_nodes.replace().clear();
+            m_ranks.replace().clear();
+            m_levels.write().clear();
+            m_level_offsets.write().clear();
+            m_level_nodes.write().clear();
+
+            auto node_count = m_all_nodes.size();
+
+            index_vector in_degrees(node_count);
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                in_degrees[i] = index_type(get_predecessors(index_type(i)).size());
+            }
+
+            index_vector queue(node_count);
+            size_t head = 0, tail = 0;
+
+            // Find "root" vertices of graph.
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                if(in_degrees[i] == 0)
+                {
+                    queue[tail++] = index_type(i);
+                }
+            }
+
+            m_roots.replace().assign(queue.begin(), queue.begin() + tail);
+
+            auto &levels = m_levels.write();
+
+            if(compute_levels)
+            {
+                levels.assign(node_count, 0);
+            }
+
+            while(head != tail)
+            {
+                auto next_index = queue[head++];
+
+                // Release destinations of edges from this vertex once all
+                // their incoming edges have been seen.
+                for(auto dst : get_successors(next_index))
+                {
+                    if(compute_levels)
+                    {
+                        levels[dst] = std::max(
+                            levels[dst], index_type(levels[next_index] + 1));
+                    }
+
+                    if(--in_degrees[dst] == 0)
+                    {
+                        queue[tail++] = dst;
+                    }
+                }
+            }
+
+            // Empty graph is valid.  Otherwise any node left unqueued is on
+            // or after a cycle.
+            m_valid = (tail == node_count);
+
+            if(m_valid)
+            {
+                set_order(queue);
+
+                if(compute_levels)
+                {
+                    group_levels();
+                }
+            }
+            else
+            {
+                m_levels.write().clear();
+            }
+        }
+
+        // Sort into level-major topological order if possible.
+        //
+        // Processes one frontier (level) at a time: the successors of the
+        // frontier whose in-degrees reach zero form the next frontier,
+        // which is then sorted by index.  In-degrees are atomics, so a
+        // large frontier is split across threads, and whichever thread
+        // takes a node's in-degree to zero adds it.  A node joins a
+        // frontier after its last predecessor, so frontiers are exactly
+        // the levels.
+        void level_sort(bool compute_levels, unsigned thread_count)
+        {
+            m_sorted_nodes.replace().clear();
+            m_ranks.replace().clear();
+            m_levels.write().clear();
+            m_level_offsets.write().clear();
+            m_level_nodes.write().clear();
+
+            auto node_count = m_all_nodes.size();
+
+            std::unique_ptr<std::atomic<index_type>[]> in_degrees(
+                new std::atomic<index_type>[node_count]);
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                in_degrees[i].store(
+                    index_type(get_predecessors(index_type(i)).size()),
+                    std::memory_order_relaxed);
+            }
+
+            // Frontiers are appended to one buffer, which ends up holding
+            // the sorted order, with level_offsets marking the levels.
+            index_vector order, level_offsets(1, 0);
+
+            order.reserve(node_count);
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                if(in_degrees[i].load(std::memory_order_relaxed) == 0)
+                {
+                    order.push_back(index_type(i));
+                }
+            }
+
+            m_roots.replace().assign(order.begin(), order.end());
+
+            auto &levels = m_levels.write();
+
+            if(compute_levels)
+            {
+                levels.assign(node_count, 0);
+            }
+
+            std::vector<index_vector> released(thread_count);
+
+            // Release successors of order[begin, end) into out.
+            auto release = [&](size_t begin, size_t end, index_vector &out)
+            {
+                // Called once the frontier's end has been pushed.
+                auto next_level = index_type(level_offsets.size() - 1);
+
+                for(size_t i = begin; i < end; ++i)
+                {
+                    for(auto dst : get_successors(order[i]))
+                    {
+                        if(in_degrees[dst].fetch_sub(1, std::memory_order_relaxed) == 1)
+                        {
+                            out.push_back(dst);
 
-        // Construct a DAG given a collection of edges.
-        //
-        // Assumption is that edges order "src" nodes before "dst" nodes.
-        //
-        // vectors are used rather than sets to keep things nicely
-        // laid out in memory.
-        template<typename EdgeIterator>
-        dag(    EdgeIterator edge_begin,
-                EdgeIterator edge_end,
-                std::enable_if_t<
-                    std::is_same<
-                        edge_type,
-                        typename std::iterator_traits<EdgeIterator>::value_type>::value,
-                    int> = 0)
-            : m_valid(false)
-        {
-            node_id_vector tmp;
-            build(edge_begin, edge_end, tmp.begin(), tmp.end());
+                            if(compute_levels)
+                            {
+                                levels[dst] = next_level;
+                            }
+                        }
+                    }
+                }
+            };
+
+            while(level_offsets.back() != order.size())
+            {
+                size_t begin = level_offsets.back(), end = order.size();
+
+                level_offsets.push_back(index_type(end));
+
+                // The frontier is sorted by index, so this bounds the
+                // number of edges out of it without visiting them.
+                auto edge_count =
+                    m_out_rows->get_row_start(order[end - 1] + 1) -
+                    m_out_rows->get_row_start(order[begin]);
+
+                if((thread_count <= 1) ||
+                   (edge_count < detail::min_parallel_frontier_edges))
+                {
+                    release(begin, end, order);
+                }
+                else
+                {
+                    std::vector<std::thread> threads;
+                    auto chunk = (end - begin + thread_count - 1) / thread_count;
+
+                    for(unsigned t = 0; t < thread_count; ++t)
+                    {
+                        auto chunk_begin = std::min(begin + t * chunk, end);
+                        auto chunk_end = std::min(chunk_begin + chunk, end);
+
+                        released[t].clear();
+
+                        threads.emplace_back(
+                            release,
+                            chunk_begin,
+                            chunk_end,
+                            std::ref(released[t]));
+                    }
+
+                    for(auto &t : threads)
+                    {
+                        t.join();
+                    }
+
+                    for(auto &r : released)
+                    {
+                        order.insert(order.end(), r.begin(), r.end());
+                    }
+                }
+
+                detail::parallel_sort_by_key(
+                    order.begin() + end,
+                    order.end(),
+                    [](index_type i){return i;},
+                    thread_count);
+            }
+
+            // Any node never released is on or after a cycle.
+            m_valid = (order.size() == node_count);
+
+            if(m_valid)
+            {
+                set_order(order);
+
+                if(compute_levels)
+                {
+                    m_level_offsets.write() = std::move(level_offsets);
+                    m_level_nodes.write() = std::move(order);
+                }
+            }
+            else
+            {
+                m_levels.write().clear();
+            }
         }
 
-        // Construct a DAG given a collection of edges and nodes.
-        // Nodes that are referenced by edges will be added so the
-        // node iterators may be used to reference orphan nodes not
-        // referenced by any edges.
-        //
-        // Assumption is that edges order "src" nodes before "dst" nodes.
-        //
-        // vectors are used rather than sets to keep things nicely
-        // laid out in memory.
-        template<typename EdgeIterator, typename NodeIterator>
-        dag(
-                EdgeIterator edge_begin,
-                EdgeIterator edge_end,
-                NodeIterator node_begin,
-                NodeIterator node_end,
-                std::enable_if_t<
-                    std::is_same<
-                        edge_type,
-                        typename std::iterator_traits<EdgeIterator>::value_type>::value &&
-                    std::is_same<
-                        node_id_type,
-                        typename std::iterator_traits<NodeIterator>::value_type>::value,
-                    int> = 0)
-            : m_valid(false)
+        // Record a topological order, given as node indices.
+        void set_order(index_vector const &order)
         {
-            build(edge_begin, edge_end, node_begin, node_end);
-        }
+            node_id_vector sorted(order.size());
+            index_vector ranks(order.size());
 
-        // Is this in a valid state.  Will return false if the input was not
-        // a DAG.
-        bool get_valid() const { return m_valid; }
+            for(size_t i = 0; i < order.size(); ++i)
+            {
+                sorted[i] = m_all_nodes[order[i]];
+                ranks[order[i]] = index_type(i);
+            }
 
-        // Get all nodes, sorted by id.
-        node_id_vector const &get_all_nodes() const
-        {
-             return m_all_nodes;
+            m_sorted_nodes.replace().assign(std::move(sorted));
+            m_ranks.replace().assign(std::move(ranks));
         }
 
-        // Get nodes in topological order.  Will be empty if this is not a DAG.
-        node_id_vector const &get_sorted_nodes() const
+        // Group node indices by m_levels with a counting sort.  Indices are
+        // visited in order, so each level comes out sorted.
+        void group_levels()
         {
-             return m_sorted_nodes;
+            auto node_count = m_levels.size();
+            index_type level_count = 0;
+
+            for(auto level : m_levels)
+            {
+                level_count = std::max(level_count, index_type(level + 1));
+            }
+
+            auto &level_offsets = m_level_offsets.write();
+
+            level_offsets.assign(level_count + 1, 0);
+
+            for(auto level : m_levels)
+            {
+                ++level_offsets[level + 1];
+            }
+
+            std::partial_sum(
+                level_offsets.begin(),
+                level_offsets.end(),
+                level_offsets.begin());
+
+            index_vector pos(level_offsets.begin(), level_offsets.end() - 1);
+
+            auto &level_nodes = m_level_nodes.write();
+
+            level_nodes.resize(node_count);
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                level_nodes[pos[m_levels[i]]++] = index_type(i);
+            }
         }
 
-        // Get edges sorted by src id.
-        edge_vector const &get_edges_by_src() const
+        // Editing helpers.
+
+        // Drop what edits don't keep up to date: the levels, and the edges
+        // by dst copied for single storage.
+        void discard_derived()
         {
-            return m_edges_by_src;
+            m_single_by_dst.reset();
+            m_levels.replace().clear();
+            m_level_offsets.replace().clear();
+            m_level_nodes.replace().clear();
         }
 
-        // Get edges sorted by dst id.
-        edge_vector const &get_edges_by_dst() const
+        // Insert a node with no edges at position index of m_all_nodes,
+        // shifting the indices of the nodes after it.  Every array indexed
+        // by, or holding, node indices is rebuilt whole.
+        void insert_node(index_type index, node_id_type id)
         {
-            return m_edges_by_dst;
-        }
+            auto node_count = m_all_nodes.size();
 
-    private:
-        // Construction helpers.
+            // Indices from index up move up one, which keeps rows sorted,
+            // and the new node gets an empty row.
+            index_vector remap(node_count), old_of_new(node_count + 1, invalid_index);
 
-        // Construct a DAG given a collection of edges and nodes.
-        template<typename EdgeIterator, typename NodeIterator>
-        void build(
-                EdgeIterator edge_begin,
-                EdgeIterator edge_end,
-                NodeIterator node_begin,
-                NodeIterator node_end)
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                remap[i] = index_type(i + (i >= index));
+                old_of_new[remap[i]] = index_type(i);
+            }
+
+            node_id_vector all(m_all_nodes.begin(), m_all_nodes.end());
+
+            all.insert(all.begin() + index, id);
+            m_all_nodes.replace().assign(std::move(all));
+            m_index_map.write().build(m_all_nodes.get());
+
+            compact_rows(m_out_rows, remap, old_of_new, {});
+            compact_rows(m_in_rows, remap, old_of_new, {});
+
+            index_vector roots;
+
+            for(auto root : m_roots)
+            {
+                roots.push_back(remap[root]);
+            }
+
+            roots.insert(std::lower_bound(roots.begin(), roots.end(), index), index);
+            m_roots.replace().assign(std::move(roots));
+
+            index_vector ranks(m_ranks.begin(), m_ranks.end());
+
+            ranks.insert(ranks.begin() + index, index_type(m_sorted_nodes.size()));
+            m_ranks.replace().assign(std::move(ranks));
+            m_sorted_nodes.write().push_back(id);
+        }
+
+        // Add src -> dst to the edge vectors and adjacency, assuming the
+        // topological order already allows it.
+        void insert_edge(edge_type const &edge, index_type src, index_type dst)
         {
-            // Set up edge vectors.
-            m_edges_by_src.insert(m_edges_by_src.end(), edge_begin, edge_end);
+            discard_derived();
 
-            std::sort(
+            // Edges by src.  New edges go after existing ones with the same
+            // src, as a stable sort would put them.
+            auto by_src = std::upper_bound(
                 m_edges_by_src.begin(),
                 m_edges_by_src.end(),
-                [](auto &a, auto &b){return a.get_src() < b.get_src();});
+                edge.get_src(),
+                [](node_id_type id, edge_type const &e){return id < e.get_src();});
 
-            m_edges_by_dst.insert(m_edges_by_dst.end(), edge_begin, edge_end);
+            m_edges_by_src.write().insert(size_t(by_src - m_edges_by_src.begin()), edge);
 
-            std::sort(
-                m_edges_by_dst.begin(),
-                m_edges_by_dst.end(),
-                [](auto &a, auto &b){return a.get_dst() < b.get_dst();});
+            if(m_storage == edge_storage::dual)
+            {
+                auto by_dst = std::upper_bound(
+                    m_edges_by_dst.begin(),
+                    m_edges_by_dst.end(),
+                    edge.get_dst(),
+                    [](node_id_type id, edge_type const &e){return id < e.get_dst();});
 
-            // gather nodes.
+                m_edges_by_dst.write().insert(size_t(by_dst - m_edges_by_dst.begin()), edge);
+            }
+
+            if(get_predecessors(dst).empty())
             {
-                node_id_vector all_nodes(node_begin, node_end);
+                auto pos = std::lower_bound(m_roots.begin(), m_roots.end(), dst);
 
-                std::for_each(
-                    m_edges_by_src.begin(),
-                    m_edges_by_src.end(),
-                    [&all_nodes](auto &edge)
-                    {
-                        all_nodes.push_back(edge.get_src());
-                        all_nodes.push_back(edge.get_dst());
-                    });
+                m_roots.write().erase(size_t(pos - m_roots.begin()));
+            }
 
-                // Sort and apply uniqueness criterion
-                std::sort(all_nodes.begin(), all_nodes.end());
+            m_out_rows.write().insert(src, dst);
+            m_in_rows.write().insert(dst, src);
+        }
 
-                all_nodes.erase(
-                    std::unique(all_nodes.begin(), all_nodes.end()),
-                    all_nodes.end());
+        // Remove every copy of edge from edges sorted by src, or by dst if
+        // by_dst.  Only the run sharing that end is searched.  Returns how
+        // many were removed.
+        static size_t erase_edge(
+                shared<edge_array>  &edges,
+                edge_type const     &edge,
+                bool                by_dst)
+        {
+            auto key = [by_dst](edge_type const &e)
+            {
+                return by_dst ? e.get_dst() : e.get_src();
+            };
+
+            auto run = std::equal_range(
+                edges.begin(),
+                edges.end(),
+                edge,
+                [&key](edge_type const &a, edge_type const &b){return key(a) < key(b);});
+
+            auto matches = [&edge](edge_type const &e)
+            {
+                return (e.get_src() == edge.get_src()) && (e.get_dst() == edge.get_dst());
+            };
+
+            auto count = size_t(std::count_if(run.first, run.second, matches));
+
+            if(count != 0)
+            {
+                // Positions, as writing may clone shared storage.
+                auto first = size_t(run.first - edges.begin());
+                auto last = size_t(run.second - edges.begin());
 
-                m_all_nodes = all_nodes;
+                edges.write().erase_if(first, last, matches);
             }
 
-            topological_sort();
+            return count;
         }
 
-        // Sort into topological order if possible.
-        void topological_sort()
+        // Remove the edges listed in keys from edges sorted by src, or by
+        // dst if by_dst, in one pass.  keys are sorted (src, dst) pairs, or
+        // (dst, src) if by_dst.  Returns how many were removed.
+        static size_t erase_listed_edges(
+                shared<edge_array>          &edges,
+                std::vector<id_pair> const  &keys,
+                bool                        by_dst)
         {
-            m_sorted_nodes.clear();
+            auto is_listed = removal_walker(keys);
 
-            // Empty graph is valid.
-            m_valid = true;
+            auto is_removed = [&is_listed, by_dst](edge_type const &e)
+            {
+                return by_dst ?
+                    is_listed(e.get_dst(), e.get_src()) :
+                    is_listed(e.get_src(), e.get_dst());
+            };
 
-            using count_record = std::pair<node_id_type, size_t>;
+            // Leave shared storage alone unless something matches.
+            auto first = size_t(
+                std::find_if(edges.begin(), edges.end(), is_removed) - edges.begin());
 
-            std::vector<count_record> incoming_counts;
+            if(first == edges.size())
+            {
+                return 0;
+            }
 
-            incoming_counts.reserve(m_all_nodes.size());
+            // Testing the first match again is harmless, as the walker
+            // only moves forward.
+            return edges.write().erase_if(first, edges.size(), is_removed);
+        }
 
-            std::transform(
-                m_all_nodes.begin(),
-                m_all_nodes.end(),
-                std::back_inserter(incoming_counts),
-                [](node_id_type const &id)->count_record
-                { return {id, size_t(0)}; });
+        // Remove the edges matching pred from the edge vectors, keeping
+        // their order.  Returns how many were removed.
+        template<typename Pred>
+        size_t erase_edges_if(Pred pred)
+        {
+            // Leave shared storage alone unless something matches.
+            auto first = size_t(
+                std::find_if(m_edges_by_src.begin(), m_edges_by_src.end(), pred) -
+                m_edges_by_src.begin());
 
-            // Initialise count of incoming edges.
-            std::for_each(
-                m_edges_by_dst.begin(),
-                m_edges_by_dst.end(),
-                [&incoming_counts](auto &edge)
-                {
-                    auto it = std::lower_bound(
-                        incoming_counts.begin(),
-                        incoming_counts.end(),
-                        edge.get_dst(),
-                        [](auto &count, auto &id)
-                        {
-                            return count.first < id;
-                        });
+            if(first == m_edges_by_src.size())
+            {
+                return 0;
+            }
 
-                    ++it->second;
-                });
-                
-            std::queue<node_id_type> to_process;
+            auto removed = m_edges_by_src.write().erase_if(
+                first, m_edges_by_src.size(), pred);
+
+            if(m_storage == edge_storage::dual)
+            {
+                m_edges_by_dst.write().erase_if(0, m_edges_by_dst.size(), pred);
+            }
+
+            return removed;
+        }
+
+        // Recompute m_roots from the adjacency.
+        void find_roots()
+        {
+            index_vector roots;
 
-            for(auto &count : incoming_counts)
+            for(size_t i = 0; i < m_in_rows->size(); ++i)
             {
-                // Find "root" vertices of graph.
-                if(count.second == 0)
+                if(get_predecessors(index_type(i)).empty())
                 {
-                    m_sorted_nodes.emplace_back(count.first);
+                    roots.push_back(index_type(i));
+                }
+            }
 
-                    // Find edges from these vertices and add their destinations
-                    // to output.
-                    auto begin_it = std::lower_bound(
-                        m_edges_by_src.begin(),
-                        m_edges_by_src.end(),
-                        count.first,
-                        [](auto &edge, auto &id)
-                        {
-                            return edge.get_src() < id;
-                        });
+            m_roots.replace().assign(std::move(roots));
+        }
 
-                    auto end_it = std::upper_bound(
-                        m_edges_by_src.begin(),
-                        m_edges_by_src.end(),
-                        count.first,
-                        [](auto &id, auto &edge)
-                        {
-                            return id < edge.get_src();
-                        });
+        // Re-sort the nodes ranked lower to upper with Kahn's algorithm,
+        // given that every edge leading out of order stays within them.
+        // Nodes outside keep their ranks.  Returns false if they contain a
+        // cycle.
+        //
+        // An edge into the range from above would itself be out of order,
+        // so every predecessor of a node in range is either in range or
+        // already placed before it.
+        //
+        // The order is passed in as plain arrays, which apply_delta builds
+        // before handing them to this dag, as writing them scattered into
+        // chunked arrays would check each chunk's ownership every time.
+        // nodes is get_all_nodes(), ranks by node index and sorted the
+        // nodes in rank order.
+        bool sort_ranks(
+                index_type              lower,
+                index_type              upper,
+                node_id_vector const    &nodes,
+                index_vector            &ranks,
+                node_id_vector          &sorted) const
+        {
+            size_t count = upper - lower + 1;
 
-                    std::for_each(
-                        begin_it,
-                        end_it,
-                        [&to_process](auto &edge)
-                        {
-                            to_process.push(edge.get_dst());
-                        });
+            index_vector in_degrees(count, 0), queue;
+            queue.reserve(count);
+
+            auto in_range = [&ranks, lower, upper](index_type index)
+            {
+                return (ranks[index] >= lower) && (ranks[index] <= upper);
+            };
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                auto index = index_of(sorted[lower + i]);
+
+                for(auto src : get_predecessors(index))
+                {
+                    in_degrees[i] += in_range(src);
+                }
+
+                if(in_degrees[i] == 0)
+                {
+                    queue.push_back(index);
                 }
             }
 
-            while(!to_process.empty())
+            for(size_t head = 0; head != queue.size(); ++head)
             {
-                auto next_vertex = to_process.front();
+                for(auto dst : get_successors(queue[head]))
+                {
+                    if(in_range(dst) && (--in_degrees[ranks[dst] - lower] == 0))
+                    {
+                        queue.push_back(dst);
+                    }
+                }
+            }
+
+            if(queue.size() != count)
+            {
+                return false;
+            }
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                ranks[queue[i]] = index_type(lower + i);
+                sorted[lower + i] = nodes[queue[i]];
+            }
+
+            return true;
+        }
+
+        // Pearce-Kelly: make room in the topological order for an edge
+        // src -> dst where src is currently ranked after dst.  Returns
+        // false, changing nothing, if dst reaches src.
+        //
+        // Only nodes ranked between dst and src can be out of order: those
+        // reachable from dst and those reaching src.  The latter all move
+        // ahead of the former, reusing the same set of ranks.
+        bool reorder(index_type src, index_type dst)
+        {
+            auto lower = m_ranks[dst], upper = m_ranks[src];
+
+            auto &marks = m_edit_marks.write();
 
-                to_process.pop();
+            marks.resize((m_all_nodes.size() + 63) / 64, 0);
 
-                auto count_it = std::lower_bound(
-                    incoming_counts.begin(),
-                    incoming_counts.end(),
-                    next_vertex,
-                    [](auto &count, auto &id)
+            auto mark = [&marks](index_type i)
+            {
+                auto &word = marks[i / 64];
+                auto bit = std::uint64_t(1) << (i % 64);
+                bool marked = (word & bit) != 0;
+
+                word |= bit;
+                return marked;
+            };
+
+            index_vector forward(1, dst), backward(1, src);
+            bool cycle = false;
+
+            mark(dst);
+            mark(src);
+
+            // Forward from dst, through nodes ranked before src.
+            for(size_t head = 0; (head != forward.size()) && !cycle; ++head)
+            {
+                for(auto next : get_successors(forward[head]))
+                {
+                    if(next == src)
                     {
-                        return count.first < id;
-                    });
+                        cycle = true;
+                        break;
+                    }
 
-                auto &count = *count_it;
+                    if((m_ranks[next] < upper) && !mark(next))
+                    {
+                        forward.push_back(next);
+                    }
+                }
+            }
 
-                if(--count.second == 0)
+            // Backward from src, through nodes ranked after dst.  Without
+            // a cycle none of these were reached forwards.
+            for(size_t head = 0; (head != backward.size()) && !cycle; ++head)
+            {
+                for(auto prev : get_predecessors(backward[head]))
                 {
-                    m_sorted_nodes.emplace_back(count.first);
+                    if((m_ranks[prev] > lower) && !mark(prev))
+                    {
+                        backward.push_back(prev);
+                    }
+                }
+            }
 
-                    // Find edges from these vertices and add their destinations
-                    // to output.
-                    auto begin_it = std::lower_bound(
-                        m_edges_by_src.begin(),
-                        m_edges_by_src.end(),
-                        count.first,
-                        [](auto &edge, auto &id)
-                        {
-                            return edge.get_src() < id;
-                        });
+            for(auto i : forward)
+            {
+                marks[i / 64] = 0;
+            }
 
-                    auto end_it = std::upper_bound(
-                        m_edges_by_src.begin(),
-                        m_edges_by_src.end(),
-                        count.first,
-                        [](auto &id, auto &edge)
-                        {
-                            return id < edge.get_src();
-                        });
+            for(auto i : backward)
+            {
+                marks[i / 64] = 0;
+            }
 
-                    std::for_each(
-                        begin_it,
-                        end_it,
-                        [&to_process](auto &edge)
-                        {
-                            to_process.push(edge.get_dst());
-                        });
-                }
+            if(cycle)
+            {
+                return false;
             }
 
-            m_valid = (m_sorted_nodes.size() == m_all_nodes.size());
+            auto by_rank = [this](index_type a, index_type b)
+            {
+                return m_ranks[a] < m_ranks[b];
+            };
+
+            std::sort(forward.begin(), forward.end(), by_rank);
+            std::sort(backward.begin(), backward.end(), by_rank);
 
-            if(!m_valid)
+            // Backward nodes, then forward nodes, take the ranks they held
+            // between them, each group keeping its own order.
+            index_vector nodes(backward);
+            nodes.insert(nodes.end(), forward.begin(), forward.end());
+
+            index_vector ranks;
+            ranks.reserve(nodes.size());
+
+            for(auto i : nodes)
             {
-                m_sorted_nodes.clear();
+                ranks.push_back(m_ranks[i]);
             }
+
+            std::sort(ranks.begin(), ranks.end());
+
+            auto &node_ranks = m_ranks.write();
+            auto &sorted = m_sorted_nodes.write();
+
+            for(size_t i = 0; i < nodes.size(); ++i)
+            {
+                node_ranks.set(nodes[i], ranks[i]);
+                sorted.set(ranks[i], m_all_nodes[nodes[i]]);
+            }
+
+            return true;
         }
 
         // true if we have a DAG.
         bool            m_valid;
 
+        edge_storage    m_storage;
+
         // We keep two copies of the edges for efficient searches up and down
-        // the graph.
-        edge_vector     m_edges_by_src,
-                        m_edges_by_dst;
+        // the graph.  With single storage m_edges_by_dst is empty, and edges
+        // by dst come from m_in_rows.
+        shared<edge_array>      m_edges_by_src,
+                                m_edges_by_dst;
+
+        // With single storage, what get_edges_by_dst() copied off
+        // m_in_rows since the last edit.  Copies of the dag start empty.
+        lazy_vector<edge_type>  m_single_by_dst;
 
-        node_id_vector  m_all_nodes,
-                        m_sorted_nodes;
+        shared<node_id_array>   m_all_nodes,
+                                m_sorted_nodes;
+
+        // id -> dense index.  The reverse mapping is m_all_nodes itself.
+        shared<node_index_map<node_id_type>> m_index_map;
+
+        // Compressed sparse row adjacency by dense node index: targets of
+        // each node's outgoing edges, and sources of its incoming ones.
+        shared<chunked_rows>    m_out_rows,
+                                m_in_rows;
+
+        // Position of each node in m_sorted_nodes, by node index.
+        shared<index_array>     m_ranks;
+
+        // Nodes with no incoming edges.
+        shared<index_array>     m_roots;
+
+        // Optional topological levels: level by node index, and node
+        // indices grouped by level, rows indexed by m_level_offsets.
+        shared<index_vector>    m_levels,
+                                m_level_offsets,
+                                m_level_nodes;
+
+        // Scratch bitset for edits, kept clear.
+        shared<std::vector<std::uint64_t>> m_edit_marks;
     };
+
+    template<typename NodeID>
+    constexpr typename dag<NodeID>::index_type dag<NodeID>::invalid_index;
 }
 
 #endif
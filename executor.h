@@ -0,0 +1,332 @@
+#ifndef INCLUDED_S3D_DAG_EXECUTOR_H
+#define INCLUDED_S3D_DAG_EXECUTOR_H
+
+#include "dag.h"
+#include "scheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace s3d_graph
+{
+    // Runs the tasks of a dag on a pool of threads, starting each task as
+    // soon as everything before it has finished.
+    //
+    // Each worker has its own deque of ready tasks.  Tasks a worker
+    // releases go on the back of its own deque and it takes work from the
+    // back, so successors tend to run on the thread that just made their
+    // inputs.  Idle workers steal from the front of other workers' deques.
+    // Dependency counts live in a concurrent_ready_tracker, so finishing a
+    // task takes no shared lock; each deque has its own small lock, only
+    // contended by stealing.
+    //
+    // The thread calling run() works too, so a single thread executor runs
+    // everything inline.  One run() at a time.
+    class dag_executor
+    {
+    public:
+        // The queues outlive any one run, so can't take the index type
+        // from the dag; run() checks the two agree.
+        using index_type = std::uint32_t;
+
+        // thread_count of 0 uses every hardware thread.
+        explicit dag_executor(unsigned thread_count = 0)
+            : m_queues(detail::resolve_thread_count(thread_count))
+            , m_generation(0)
+            , m_finished_workers(0)
+            , m_stop(false)
+            , m_queued(0)
+            , m_unfinished(0)
+            , m_sleepers(0)
+            , m_failed(false)
+        {
+            for(unsigned w = 1; w < m_queues.size(); ++w)
+            {
+                m_threads.emplace_back([this, w]{ worker_main(w); });
+            }
+        }
+
+        ~dag_executor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cv.notify_all();
+
+            for(auto &t : m_threads)
+            {
+                t.join();
+            }
+        }
+
+        dag_executor(dag_executor const &) = delete;
+        dag_executor &operator=(dag_executor const &) = delete;
+
+        // Number of threads tasks run on, including the caller of run().
+        unsigned get_thread_count() const
+        {
+            return unsigned(m_queues.size());
+        }
+
+        // Call task(id) once for every node in graph, never before the
+        // tasks for all nodes with edges leading to it have returned.
+        // Blocks until every task has run.
+        //
+        // Returns false without running anything if the graph is invalid.
+        // If a task throws, no more tasks are started and the first
+        // exception is rethrown once running tasks have finished.
+        template<typename T, typename Fn>
+        bool run(dag<T> const &graph, Fn &&task)
+        {
+            static_assert(
+                std::is_same<typename dag<T>::index_type, index_type>::value,
+                "dag_executor::index_type must match dag<T>::index_type");
+
+            if(!graph.get_valid())
+            {
+                return false;
+            }
+
+            auto node_count = graph.get_node_count();
+
+            if(node_count == 0)
+            {
+                return true;
+            }
+
+            concurrent_ready_tracker<T> tracker(graph);
+
+            m_execute = [this, &graph, &task, &tracker](index_type index, unsigned worker)
+            {
+                if(!m_failed.load(std::memory_order_relaxed))
+                {
+                    try
+                    {
+                        task(graph.id_of(index));
+                    }
+                    catch(...)
+                    {
+                        fail(std::current_exception());
+                    }
+                }
+
+                // Release successors even after a failure, so the run
+                // drains without starting anything else.
+                tracker.mark_done_index(
+                    index,
+                    [this, worker](index_type dst){ push(worker, dst); });
+            };
+
+            m_failed.store(false);
+            m_error = nullptr;
+            m_unfinished.store(node_count);
+
+            // Spread the roots across the workers.
+            auto &roots = graph.get_root_indices();
+
+            for(size_t i = 0; i < roots.size(); ++i)
+            {
+                push(unsigned(i % m_queues.size()), roots[i]);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_finished_workers = 0;
+                ++m_generation;
+            }
+
+            m_cv.notify_all();
+
+            work(0);
+
+            // Wait for the other workers to leave this run before the
+            // task goes out of scope.
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(
+                    lock,
+                    [this]{ return m_finished_workers + 1 == m_queues.size(); });
+            }
+
+            m_execute = nullptr;
+
+            if(m_error)
+            {
+                std::rethrow_exception(m_error);
+            }
+
+            return true;
+        }
+
+    private:
+        struct worker_queue
+        {
+            std::mutex              mutex;
+            std::deque<index_type>  tasks;
+        };
+
+        void worker_main(unsigned worker)
+        {
+            size_t seen_generation = 0;
+
+            for(;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    m_cv.wait(
+                        lock,
+                        [&]{ return m_stop || (m_generation != seen_generation); });
+
+                    if(m_stop)
+                    {
+                        return;
+                    }
+
+                    seen_generation = m_generation;
+                }
+
+                work(worker);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    ++m_finished_workers;
+                }
+
+                m_cv.notify_all();
+            }
+        }
+
+        // Run tasks until every task in the current run has finished.
+        void work(unsigned worker)
+        {
+            while(m_unfinished.load() != 0)
+            {
+                index_type index;
+
+                if(pop(worker, index) || steal(worker, index))
+                {
+                    m_execute(index, worker);
+
+                    if(--m_unfinished == 0)
+                    {
+                        // Wake everyone so they see the run is over.
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_cv.notify_all();
+                    }
+                }
+                else
+                {
+                    // Nothing to do until some running task releases more.
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    ++m_sleepers;
+
+                    m_cv.wait(
+                        lock,
+                        [this]{ return (m_queued.load() != 0) || (m_unfinished.load() == 0); });
+
+                    --m_sleepers;
+                }
+            }
+        }
+
+        void push(unsigned worker, index_type index)
+        {
+            {
+                auto &queue = m_queues[worker];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(index);
+            }
+
+            ++m_queued;
+
+            // A sleeper checks m_queued after announcing itself, so either
+            // it sees this task or we see it and wake it.
+            if(m_sleepers.load() != 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cv.notify_one();
+            }
+        }
+
+        bool pop(unsigned worker, index_type &index)
+        {
+            auto &queue = m_queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if(queue.tasks.empty())
+            {
+                return false;
+            }
+
+            index = queue.tasks.back();
+            queue.tasks.pop_back();
+            --m_queued;
+            return true;
+        }
+
+        bool steal(unsigned worker, index_type &index)
+        {
+            auto queue_count = unsigned(m_queues.size());
+
+            for(unsigned i = 1; i < queue_count; ++i)
+            {
+                auto &queue = m_queues[(worker + i) % queue_count];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+
+                if(!queue.tasks.empty())
+                {
+                    index = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    --m_queued;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void fail(std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if(!m_error)
+            {
+                m_error = error;
+            }
+
+            m_failed.store(true);
+        }
+
+        std::vector<worker_queue>   m_queues;
+        std::vector<std::thread>    m_threads;
+
+        // Guards run start/end, sleeping and the stored error.
+        std::mutex                  m_mutex;
+        std::condition_variable     m_cv;
+        size_t                      m_generation;
+        size_t                      m_finished_workers;
+        bool                        m_stop;
+
+        // State of the current run.
+        std::function<void(index_type, unsigned)>   m_execute;
+
+        std::atomic<size_t>         m_queued,
+                                    m_unfinished;
+        std::atomic<unsigned>       m_sleepers;
+        std::atomic<bool>           m_failed;
+        std::exception_ptr          m_error;
+    };
+}
+
+#endif
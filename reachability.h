@@ -0,0 +1,586 @@
+#ifndef INCLUDED_S3D_DAG_REACHABILITY_H
+#define INCLUDED_S3D_DAG_REACHABILITY_H
+
+#include "dag.h"
+#include "algorithms.h"
+#include <random>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace s3d_graph
+{
+    // Indexes that answer "is there a path from a to b?" without
+    // traversing the graph.
+
+    namespace detail
+    {
+        // dst[i] |= src[i] for count words.
+        inline void or_words(
+                std::uint64_t *dst,
+                std::uint64_t const *src,
+                size_t count)
+        {
+            size_t i = 0;
+
+#if defined(__AVX2__)
+            for(; i + 4 <= count; i += 4)
+            {
+                auto d = reinterpret_cast<__m256i *>(dst + i);
+                auto s = reinterpret_cast<__m256i const *>(src + i);
+
+                _mm256_storeu_si256(
+                    d,
+                    _mm256_or_si256(_mm256_loadu_si256(d), _mm256_loadu_si256(s)));
+            }
+#elif defined(__SSE2__)
+            for(; i + 2 <= count; i += 2)
+            {
+                auto d = reinterpret_cast<__m128i *>(dst + i);
+                auto s = reinterpret_cast<__m128i const *>(src + i);
+
+                _mm_storeu_si128(
+                    d,
+                    _mm_or_si128(_mm_loadu_si128(d), _mm_loadu_si128(s)));
+            }
+#endif
+
+            for(; i < count; ++i)
+            {
+                dst[i] |= src[i];
+            }
+        }
+    }
+
+    // The full transitive closure of a dag, as one bitset row per node
+    // holding the nodes reachable from it.
+    //
+    // Rows are built in reverse topological order, each the OR of its
+    // successors' rows, so building is O(E * V / 64) and queries are bit
+    // tests.  Memory is V * V / 8 bytes, about 300MB for 50k nodes, so
+    // this is for small, hot graphs.
+    //
+    // Only rows are kept, not columns, as a transposed copy would double
+    // that memory.  So find_all_siblings, which needs the nodes reaching
+    // a node as well as those it reaches, reads a column: V bit tests,
+    // one per row, each a likely cache miss, on every query.
+    //
+    // The dag must outlive the closure and must not be edited while it
+    // exists.  Rows are by node index, and edits such as add_edge,
+    // remove_node or apply_delta can renumber nodes, so answers would
+    // silently be wrong.  Build a new closure after editing.
+    template<typename T>
+    class transitive_closure
+    {
+    public:
+        using node_id_type      = T;
+        using node_id_vector    = typename dag<T>::node_id_vector;
+        using index_type        = typename dag<T>::index_type;
+        using word_type         = std::uint64_t;
+        using row_span          = const_span<word_type>;
+
+        // Build the closure.  Empty if the graph is invalid.
+        explicit transitive_closure(dag<T> const &graph)
+            : m_graph(&graph)
+            , m_valid(graph.get_valid())
+            , m_node_count(0)
+            , m_word_count(0)
+        {
+            if(!m_valid)
+            {
+                return;
+            }
+
+            m_node_count = graph.get_node_count();
+            m_word_count = (m_node_count + 63) / 64;
+            m_rows.assign(m_node_count * m_word_count, 0);
+
+            auto &sorted = graph.get_sorted_nodes();
+
+            // Successors come later in topological order, so walking it
+            // backwards finds their rows complete.
+            for(auto it = sorted.rbegin(); it != sorted.rend(); ++it)
+            {
+                auto index = graph.index_of(*it);
+                auto row = row_data(index);
+
+                for(auto dst : graph.get_successors(index))
+                {
+                    row[dst / 64] |= word_type(1) << (dst % 64);
+                    detail::or_words(row, row_data(dst), m_word_count);
+                }
+            }
+        }
+
+        // Was the graph valid when the closure was built?
+        bool get_valid() const { return m_valid; }
+
+        // Bytes used by the rows.
+        size_t get_memory_size() const
+        {
+            return m_rows.size() * sizeof(word_type);
+        }
+
+        // Get the bitset of nodes reachable from a node, bit i standing
+        // for node index i.  Bits past the last node are zero.  Empty if
+        // the closure is.
+        row_span get_row(index_type index) const
+        {
+            if(index >= m_node_count)
+            {
+                return {nullptr, nullptr};
+            }
+
+            auto row = m_rows.data() + index * m_word_count;
+
+            return {row, row + m_word_count};
+        }
+
+        // Is there a path from src to dst?  By node index.  A node doesn't
+        // reach itself.  false if the closure is empty.
+        bool is_reachable_index(index_type src, index_type dst) const
+        {
+            return
+                (src < m_node_count) &&
+                (dst < m_node_count) &&
+                (m_rows[src * m_word_count + dst / 64] >> (dst % 64)) & 1;
+        }
+
+        // Is there a path from src to dst?  false if either isn't in the
+        // graph, or the graph was invalid.
+        bool is_reachable(node_id_type src, node_id_type dst) const
+        {
+            auto src_index = m_graph->index_of(src);
+            auto dst_index = m_graph->index_of(dst);
+
+            return
+                get_valid() &&
+                (src_index != dag<T>::invalid_index) &&
+                (dst_index != dag<T>::invalid_index) &&
+                is_reachable_index(src_index, dst_index);
+        }
+
+        // As the find_all_after in algorithms.h, read from the closure.
+        // output will be sorted by node id.
+        bool find_all_after(
+                node_id_type node_id,
+                node_id_vector &out) const
+        {
+            out.clear();
+
+            if(!get_valid())
+            {
+                return false;
+            }
+
+            auto index = m_graph->index_of(node_id);
+
+            if(index != dag<T>::invalid_index)
+            {
+                auto row = get_row(index);
+
+                for(size_t w = 0; w < m_word_count; ++w)
+                {
+                    gather_word(w, row[w], out);
+                }
+            }
+
+            return true;
+        }
+
+        // As the find_all_siblings in algorithms.h, read from the closure:
+        // nodes that are in neither the node's row nor have it in theirs.
+        // output will be sorted by node id.
+        //
+        // O(V) per query, as the node's column takes a bit test in every
+        // row, against O(V / 64) for find_all_after.
+        bool find_all_siblings(
+                node_id_type node_id,
+                node_id_vector &out) const
+        {
+            out.clear();
+
+            auto index = m_graph->index_of(node_id);
+
+            if(!get_valid() || (index == dag<T>::invalid_index))
+            {
+                return false;
+            }
+
+            auto row = get_row(index);
+
+            for(size_t w = 0; w < m_word_count; ++w)
+            {
+                // Nodes of this word that reach the input, from its column.
+                word_type before = 0;
+                auto word_nodes = std::min<size_t>(64, m_node_count - w * 64);
+
+                for(size_t bit = 0; bit < word_nodes; ++bit)
+                {
+                    before |= word_type(
+                        is_reachable_index(index_type(w * 64 + bit), index)) << bit;
+                }
+
+                auto word = ~(row[w] | before);
+
+                // Ignore the input and bits past the last node.
+                if(index / 64 == w)
+                {
+                    word &= ~(word_type(1) << (index % 64));
+                }
+
+                if(word_nodes < 64)
+                {
+                    word &= (word_type(1) << word_nodes) - 1;
+                }
+
+                gather_word(w, word, out);
+            }
+
+            return true;
+        }
+
+    private:
+        word_type *row_data(index_type index)
+        {
+            return m_rows.data() + index * m_word_count;
+        }
+
+        // Append the ids of the nodes set in word w of a bitset.
+        void gather_word(size_t w, word_type word, node_id_vector &out) const
+        {
+            while(word != 0)
+            {
+                auto bit = detail::lowest_bit(word);
+                out.emplace_back(m_graph->id_of(index_type(w * 64 + bit)));
+                word &= word - 1;
+            }
+        }
+
+        dag<T> const            *m_graph;
+
+        // The graph as it was when built.
+        bool                    m_valid;
+        size_t                  m_node_count,
+                                m_word_count;
+
+        // m_word_count words per node, by node index.
+        std::vector<word_type>  m_rows;
+    };
+
+    // A compact reachability index for graphs too big for a
+    // transitive_closure, using GRAIL style interval labels.
+    //
+    // Each of k labelings is a randomised depth first traversal that gives
+    // every node the interval [low, post], where post is its post-order
+    // number and low the smallest post-order number below it.  If a
+    // reaches b then b's interval lies inside a's in every labeling, so a
+    // query whose intervals aren't nested is answered "no" in O(k).  Only
+    // when they nest is a search needed, and that only descends into
+    // nodes whose intervals still contain the target.
+    //
+    // Memory is 8k bytes per node.  Labelings are independent, so they
+    // are built on up to k threads.
+    //
+    // The dag must outlive the index and must not be edited while it
+    // exists, as labels are by node index and searches walk the dag's
+    // current adjacency.
+    template<typename T>
+    class interval_index
+    {
+    public:
+        using node_id_type      = T;
+        using index_type        = typename dag<T>::index_type;
+        using index_vector      = typename dag<T>::index_vector;
+
+        // Build label_count labelings, with thread_count threads (0 for
+        // every hardware thread).  Empty if the graph is invalid.
+        explicit interval_index(
+                dag<T> const &graph,
+                unsigned label_count = 3,
+                unsigned thread_count = 1)
+            : m_graph(&graph)
+            , m_valid(graph.get_valid())
+            , m_node_count(0)
+            , m_label_count(std::max(label_count, 1u))
+        {
+            if(!m_valid)
+            {
+                return;
+            }
+
+            auto node_count = graph.get_node_count();
+
+            m_node_count = node_count;
+
+            // One buffer per labeling, so threads don't share cache lines,
+            // then interleaved so a node's labels are adjacent.
+            std::vector<std::vector<interval>> labelings(m_label_count);
+
+            auto label = [&](unsigned i)
+            {
+                build_labeling(i, labelings[i]);
+            };
+
+            thread_count = std::min(
+                detail::resolve_thread_count(thread_count), m_label_count);
+
+            if(thread_count > 1)
+            {
+                std::vector<std::thread> threads;
+
+                for(unsigned t = 0; t < thread_count; ++t)
+                {
+                    threads.emplace_back(
+                        [&, t]
+                        {
+                            for(auto i = t; i < m_label_count; i += thread_count)
+                            {
+                                label(i);
+                            }
+                        });
+                }
+
+                for(auto &t : threads)
+                {
+                    t.join();
+                }
+            }
+            else
+            {
+                for(unsigned i = 0; i < m_label_count; ++i)
+                {
+                    label(i);
+                }
+            }
+
+            m_labels.resize(node_count * m_label_count);
+
+            for(size_t n = 0; n < node_count; ++n)
+            {
+                for(unsigned i = 0; i < m_label_count; ++i)
+                {
+                    m_labels[n * m_label_count + i] = labelings[i][n];
+                }
+            }
+        }
+
+        // Was the graph valid when the index was built?
+        bool get_valid() const { return m_valid; }
+
+        // Bytes used by the labels.
+        size_t get_memory_size() const
+        {
+            return m_labels.size() * sizeof(interval);
+        }
+
+        // Can the labels alone rule out a path from src to dst?  O(k).
+        // Always true if the index is empty.
+        bool get_excluded(index_type src, index_type dst) const
+        {
+            return
+                (src >= m_node_count) ||
+                (dst >= m_node_count) ||
+                !contains(src, dst) ||
+                (src == dst);
+        }
+
+        // Is there a path from src to dst?  By node index.  A node doesn't
+        // reach itself.
+        bool is_reachable_index(
+                index_type src,
+                index_type dst,
+                traversal_workspace<T> &workspace) const
+        {
+            if(get_excluded(src, dst))
+            {
+                return false;
+            }
+
+            workspace.reserve(*m_graph);
+
+            auto &visited = workspace.get_visited();
+            auto &queue = workspace.get_to_process();
+            bool found = false;
+
+            queue.clear();
+            queue.push_back(src);
+
+            // Every node queued stays in the queue, so its visited bit can
+            // be cleared afterwards.
+            for(size_t head = 0; (head != queue.size()) && !found; ++head)
+            {
+                for(auto next : m_graph->get_successors(queue[head]))
+                {
+                    auto &word = visited[next / 64];
+                    auto bit = std::uint64_t(1) << (next % 64);
+
+                    if(next == dst)
+                    {
+                        found = true;
+                        break;
+                    }
+
+                    if(((word & bit) == 0) && contains(next, dst))
+                    {
+                        word |= bit;
+                        queue.push_back(next);
+                    }
+                }
+            }
+
+            for(auto index : queue)
+            {
+                visited[index / 64] = 0;
+            }
+
+            queue.clear();
+            return found;
+        }
+
+        // Is there a path from src to dst?  false if either isn't in the
+        // graph.
+        bool is_reachable(
+                node_id_type src,
+                node_id_type dst,
+                traversal_workspace<T> &workspace) const
+        {
+            auto src_index = m_graph->index_of(src);
+            auto dst_index = m_graph->index_of(dst);
+
+            return
+                get_valid() &&
+                (src_index != dag<T>::invalid_index) &&
+                (dst_index != dag<T>::invalid_index) &&
+                is_reachable_index(src_index, dst_index, workspace);
+        }
+
+        // As above, allocating a workspace if the labels don't give the
+        // answer.  That is O(V) to allocate and clear, so keep a workspace
+        // for repeated queries the labels can't settle.
+        bool is_reachable(node_id_type src, node_id_type dst) const
+        {
+            auto src_index = m_graph->index_of(src);
+            auto dst_index = m_graph->index_of(dst);
+
+            if(!get_valid() ||
+               (src_index == dag<T>::invalid_index) ||
+               (dst_index == dag<T>::invalid_index) ||
+               get_excluded(src_index, dst_index))
+            {
+                return false;
+            }
+
+            traversal_workspace<T> workspace;
+
+            return is_reachable_index(src_index, dst_index, workspace);
+        }
+
+    private:
+        struct interval
+        {
+            index_type  low,
+                        post;
+        };
+
+        // Does every interval of outer contain the matching one of inner?
+        bool contains(index_type outer, index_type inner) const
+        {
+            auto a = m_labels.data() + size_t(outer) * m_label_count;
+            auto b = m_labels.data() + size_t(inner) * m_label_count;
+
+            for(unsigned i = 0; i < m_label_count; ++i)
+            {
+                if((b[i].low < a[i].low) || (b[i].post > a[i].post))
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // One randomised post-order traversal from every root.  Roots are
+        // taken in a shuffled order and each node's children from a random
+        // starting point.
+        void build_labeling(unsigned seed, std::vector<interval> &labels) const
+        {
+            auto node_count = m_graph->get_node_count();
+
+            std::mt19937 rng(seed);
+            std::vector<std::uint8_t> visited(node_count, 0);
+
+            // Stack of (node, children tried so far), with each node's
+            // random starting child.
+            std::vector<std::pair<index_type, index_type>> stack;
+            index_vector first_child(node_count);
+            index_vector roots = m_graph->get_root_indices();
+            index_type post = 0;
+
+            labels.resize(node_count);
+
+            std::shuffle(roots.begin(), roots.end(), rng);
+
+            for(size_t i = 0; i < node_count; ++i)
+            {
+                auto degree = m_graph->get_successors(index_type(i)).size();
+                first_child[i] = (degree > 1) ? index_type(rng() % degree) : 0;
+            }
+
+            for(auto root : roots)
+            {
+                visited[root] = 1;
+                stack.emplace_back(root, 0);
+
+                while(!stack.empty())
+                {
+                    auto &top = stack.back();
+                    auto node = top.first;
+                    auto children = m_graph->get_successors(node);
+
+                    if(top.second < children.size())
+                    {
+                        auto child = children[
+                            (first_child[node] + top.second++) % children.size()];
+
+                        if(!visited[child])
+                        {
+                            visited[child] = 1;
+                            stack.emplace_back(child, 0);
+                        }
+                    }
+                    else
+                    {
+                        // Every child is finished, so low is final.
+                        auto low = post;
+
+                        for(auto child : children)
+                        {
+                            low = std::min(low, labels[child].low);
+                        }
+
+                        labels[node] = {low, post++};
+                        stack.pop_back();
+                    }
+                }
+            }
+        }
+
+        dag<T> const            *m_graph;
+
+        // The graph as it was when built.
+        bool                    m_valid;
+        size_t                  m_node_count;
+
+        unsigned                m_label_count;
+
+        // m_label_count intervals per node, by node index.
+        std::vector<interval>   m_labels;
+    };
+}
+
+#endif
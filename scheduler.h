@@ -0,0 +1,275 @@
+#ifndef INCLUDED_S3D_DAG_SCHEDULER_H
+#define INCLUDED_S3D_DAG_SCHEDULER_H
+
+#include "dag.h"
+#include <atomic>
+#include <memory>
+
+namespace s3d_graph
+{
+    // Scheduling helpers for dags whose nodes are tasks and whose edges are
+    // dependencies.
+
+    // Tracks which tasks are ready to run as tasks complete.
+    //
+    // Keeps a count of unfinished dependencies per task, so completing a
+    // task costs O(out-degree) and reports only the tasks it unblocked,
+    // rather than recomputing the whole ready set as find_current_tasks
+    // does.
+    //
+    // The dag must outlive the tracker.
+    template<typename T>
+    class ready_tracker
+    {
+    public:
+        using node_id_type      = T;
+        using node_id_vector    = typename dag<T>::node_id_vector;
+        using index_type        = typename dag<T>::index_type;
+        using index_vector      = typename dag<T>::index_vector;
+
+        explicit ready_tracker(dag<T> const &graph)
+            : m_graph(&graph)
+            , m_done_count(0)
+        {
+            reset();
+        }
+
+        // Forget all completed tasks.
+        void reset()
+        {
+            auto node_count = m_graph->get_node_count();
+
+            m_remaining.resize(node_count);
+            m_done.assign(node_count, 0);
+            m_done_count = 0;
+
+            for(index_type i = 0; i < node_count; ++i)
+            {
+                m_remaining[i] = index_type(m_graph->get_predecessors(i).size());
+            }
+        }
+
+        // Get tasks that are ready before anything has been done.
+        // output will be sorted by node id.
+        bool get_initial(node_id_vector &out) const
+        {
+            out.clear();
+
+            if(m_graph->get_valid())
+            {
+                for(auto index : m_graph->get_root_indices())
+                {
+                    out.emplace_back(m_graph->id_of(index));
+                }
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        // Mark a ready task done, and find the tasks that this made ready.
+        // output will be sorted by node id.
+        //
+        // Returns false, changing nothing, if the graph is invalid, the
+        // task isn't in it, is already done or still has dependencies
+        // outstanding.
+        bool mark_done(node_id_type id, node_id_vector &newly_ready)
+        {
+            newly_ready.clear();
+
+            auto index = m_graph->index_of(id);
+
+            if(!can_mark_done(index))
+            {
+                return false;
+            }
+
+            m_done[index] = 1;
+            ++m_done_count;
+
+            for(auto dst : m_graph->get_successors(index))
+            {
+                if(--m_remaining[dst] == 0)
+                {
+                    newly_ready.emplace_back(m_graph->id_of(dst));
+                }
+            }
+
+            return true;
+        }
+
+        // Has this task been marked done?
+        bool get_done(node_id_type id) const
+        {
+            auto index = m_graph->index_of(id);
+
+            return (index != dag<T>::invalid_index) && m_done[index];
+        }
+
+        // How many tasks have been marked done.
+        size_t get_done_count() const { return m_done_count; }
+
+        // Have all tasks been marked done?
+        bool get_finished() const
+        {
+            return m_done_count == m_done.size();
+        }
+
+    private:
+        bool can_mark_done(index_type index) const
+        {
+            return
+                m_graph->get_valid() &&
+                (index != dag<T>::invalid_index) &&
+                !m_done[index] &&
+                (m_remaining[index] == 0);
+        }
+
+        dag<T> const                *m_graph;
+
+        // Unfinished dependencies per task, by node index.
+        index_vector                m_remaining;
+
+        std::vector<std::uint8_t>   m_done;
+        size_t                      m_done_count;
+    };
+
+    // A ready_tracker that many threads can complete tasks on at once.
+    //
+    // Remaining dependency counts are a flat array of atomics indexed by
+    // node index.  Completing a task decrements its successors' counts
+    // lock-free, and the thread that takes a count to zero is the only
+    // one told about that task, so it can claim it without further
+    // synchronisation.
+    //
+    // The dag must outlive the tracker.
+    template<typename T>
+    class concurrent_ready_tracker
+    {
+    public:
+        using node_id_type      = T;
+        using node_id_vector    = typename dag<T>::node_id_vector;
+        using index_type        = typename dag<T>::index_type;
+
+        explicit concurrent_ready_tracker(dag<T> const &graph)
+            : m_graph(&graph)
+            , m_node_count(graph.get_node_count())
+            , m_remaining(new std::atomic<index_type>[m_node_count])
+            , m_done(new std::atomic<bool>[m_node_count])
+            , m_done_count(0)
+        {
+            reset();
+        }
+
+        // Forget all completed tasks.  Not thread safe.
+        void reset()
+        {
+            for(index_type i = 0; i < m_node_count; ++i)
+            {
+                m_remaining[i].store(
+                    index_type(m_graph->get_predecessors(i).size()),
+                    std::memory_order_relaxed);
+                m_done[i].store(false, std::memory_order_relaxed);
+            }
+
+            m_done_count.store(0);
+        }
+
+        // Get tasks that are ready before anything has been done.
+        // output will be sorted by node id.
+        bool get_initial(node_id_vector &out) const
+        {
+            out.clear();
+
+            if(m_graph->get_valid())
+            {
+                for(auto index : m_graph->get_root_indices())
+                {
+                    out.emplace_back(m_graph->id_of(index));
+                }
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        // Mark a ready task done, by node index, calling on_ready(index)
+        // for each task that this made ready.  Thread safe.
+        //
+        // Returns false, changing nothing, if the graph is invalid, the
+        // task isn't in it, is already done or still has dependencies
+        // outstanding.
+        template<typename Fn>
+        bool mark_done_index(index_type index, Fn &&on_ready)
+        {
+            if(!m_graph->get_valid() ||
+               (index >= m_node_count) ||
+               (m_remaining[index].load(std::memory_order_acquire) != 0) ||
+               m_done[index].exchange(true, std::memory_order_acq_rel))
+            {
+                return false;
+            }
+
+            m_done_count.fetch_add(1, std::memory_order_relaxed);
+
+            // acq_rel so whoever releases a task sees the work of every
+            // task before it.
+            for(auto dst : m_graph->get_successors(index))
+            {
+                if(m_remaining[dst].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    on_ready(dst);
+                }
+            }
+
+            return true;
+        }
+
+        // Mark a ready task done, and find the tasks that this made ready.
+        // output will be sorted by node id.  Thread safe, given a
+        // newly_ready vector per thread.
+        bool mark_done(node_id_type id, node_id_vector &newly_ready)
+        {
+            newly_ready.clear();
+
+            return mark_done_index(
+                m_graph->index_of(id),
+                [this, &newly_ready](index_type dst)
+                {
+                    newly_ready.emplace_back(m_graph->id_of(dst));
+                });
+        }
+
+        // Has this task been marked done?
+        bool get_done(node_id_type id) const
+        {
+            auto index = m_graph->index_of(id);
+
+            return (index != dag<T>::invalid_index) && m_done[index].load();
+        }
+
+        // How many tasks have been marked done.
+        size_t get_done_count() const { return m_done_count.load(); }
+
+        // Have all tasks been marked done?
+        bool get_finished() const
+        {
+            return m_done_count.load() == m_node_count;
+        }
+
+    private:
+        dag<T> const                                *m_graph;
+        size_t                                      m_node_count;
+
+        // Unfinished dependencies per task, by node index.
+        std::unique_ptr<std::atomic<index_type>[]>  m_remaining;
+        std::unique_ptr<std::atomic<bool>[]>        m_done;
+        std::atomic<size_t>                         m_done_count;
+    };
+}
+
+#endif
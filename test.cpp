@@ -1,5 +1,14 @@
 #include "dag.h"
 #include "algorithms.h"
+#include "scheduler.h"
+#include "executor.h"
+#include "reachability.h"
+#include "concurrent_dag.h"
+#include <atomic>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
 #include <cstdio>
 
 int main(int, char **)
@@ -49,6 +58,22 @@ int main(int, char **)
         }
     }
     
+    {
+        printf("\nsuccessors of 0 (expect 1, 3) : \n");
+
+        for(auto n : graph.get_successors(graph.index_of(0)))
+        {
+            printf("%i\n", graph.id_of(n));
+        }
+
+        printf("\npredecessors of 4 (expect 2, 3) : \n");
+
+        for(auto n : graph.get_predecessors(graph.index_of(4)))
+        {
+            printf("%i\n", graph.id_of(n));
+        }
+    }
+
     {
         std::vector<uint32_t> before;
         find_before(graph, 2u, before);
@@ -180,5 +205,1132 @@ int main(int, char **)
         }
     }
 
+    {
+        std::vector<uint32_t> done = {4, 0, 1, 2, 3, 2};
+        std::vector<uint32_t> next;
+
+        find_current_tasks(graph, std::vector<uint32_t>(), next);
+
+        printf("\nrun tasks with nothing done (expect 0) : \n");
+
+        for(auto &n : next)
+        {
+            printf("%i\n", n);
+        }
+
+        find_current_tasks(graph, done, next);
+
+        printf("\nrun tasks with everything done (expect none) : \n");
+
+        for(auto &n : next)
+        {
+            printf("%i\n", n);
+        }
+    }
+
+    {
+        ready_tracker<uint32_t> tracker(graph);
+        std::vector<uint32_t> ready;
+
+        tracker.get_initial(ready);
+
+        printf("\ntracker initial (expect 0) : \n");
+
+        for(auto &n : ready)
+        {
+            printf("%i\n", n);
+        }
+
+        printf("\ntracker done 0, 3, 1, 2 (expect 1 3 | | 2 | 4) : \n");
+
+        for(uint32_t id : {0u, 3u, 1u, 2u})
+        {
+            tracker.mark_done(id, ready);
+
+            for(auto &n : ready)
+            {
+                printf("%i ", n);
+            }
+
+            printf(id == 2u ? "\n" : "| ");
+        }
+
+        printf("\ntracker rejects 2 again, 4 then 4 again (expect 0 1 0) : \n");
+
+        for(uint32_t id : {2u, 4u, 4u})
+        {
+            printf("%i ", int(tracker.mark_done(id, ready)));
+        }
+
+        printf("\n");
+
+        printf("\ntracker finished (expect 1) : \n");
+        printf("%i\n", int(tracker.get_finished()));
+    }
+
+    {
+        // One workspace shared by several queries.
+        traversal_workspace<uint32_t> workspace(graph);
+        std::vector<uint32_t> out;
+
+        auto print_out = [&out](char const *separator)
+        {
+            for(auto &n : out)
+            {
+                printf("%i ", n);
+            }
+
+            printf("%s", separator);
+        };
+
+        printf("\nworkspace queries (expect 1 2 3 4 | 0 1 | 3 | 1 3) : \n");
+
+        find_all_after(graph, 0u, workspace, out);
+        print_out("| ");
+
+        find_all_before(graph, 2u, workspace, out);
+        print_out("| ");
+
+        find_all_siblings(graph, 1u, workspace, out);
+        print_out("| ");
+
+        find_current_tasks(graph, {0}, workspace, out);
+        print_out("");
+        printf("\n");
+
+        printf("\ncycle from 4->0, 2->3, 1->1, 4->9 (expect 1 0 1 0) : \n");
+
+        for(auto pair : {std::make_pair(4u, 0u),
+                         std::make_pair(2u, 3u),
+                         std::make_pair(1u, 1u),
+                         std::make_pair(4u, 9u)})
+        {
+            printf("%i ", int(would_create_cycle(graph, pair.first, pair.second, workspace)));
+        }
+
+        printf("\n");
+
+        printf("\nreachable 0->4, 1->4, 3->2, 4->0, 2->2 (expect 1 1 0 0 0) : \n");
+
+        for(auto pair : {std::make_pair(0u, 4u),
+                         std::make_pair(1u, 4u),
+                         std::make_pair(3u, 2u),
+                         std::make_pair(4u, 0u),
+                         std::make_pair(2u, 2u)})
+        {
+            printf("%i ", int(is_reachable(graph, pair.first, pair.second, workspace)));
+        }
+
+        printf("\n");
+    }
+
+    {
+        transitive_closure<uint32_t> closure(graph);
+        std::vector<uint32_t> out;
+
+        printf("\nclosure reaches 0->4, 3->2, 4->0 (expect 1 0 0) : \n");
+        printf("%i %i %i\n",
+               int(closure.is_reachable(0u, 4u)),
+               int(closure.is_reachable(3u, 2u)),
+               int(closure.is_reachable(4u, 0u)));
+
+        printf("\nclosure after 0, siblings of 1 (expect 1 2 3 4 | 3) : \n");
+
+        closure.find_all_after(0u, out);
+
+        for(auto &n : out)
+        {
+            printf("%i ", n);
+        }
+
+        printf("| ");
+
+        closure.find_all_siblings(1u, out);
+
+        for(auto &n : out)
+        {
+            printf("%i ", n);
+        }
+
+        printf("\n");
+    }
+
+    {
+        // Compare interval labels against the closure.
+        std::vector<edge_type> mesh_edges;
+
+        for(uint32_t i = 0; i < 6000; ++i)
+        {
+            auto a = (i * 7919u) % 1500u, b = (i * 104729u + 13u) % 1500u;
+
+            if(a != b)
+            {
+                mesh_edges.emplace_back(std::min(a, b), std::max(a, b));
+            }
+        }
+
+        dag_type mesh(mesh_edges.begin(), mesh_edges.end());
+        transitive_closure<uint32_t> closure(mesh);
+        interval_index<uint32_t> intervals(mesh, 3, 3);
+        traversal_workspace<uint32_t> workspace(mesh);
+        size_t mismatches = 0;
+
+        for(auto a : mesh.get_all_nodes())
+        {
+            for(uint32_t b = 0; b < 1500u; b += 7u)
+            {
+                mismatches +=
+                    (closure.is_reachable(a, b) !=
+                     intervals.is_reachable(a, b, workspace)) +
+                    (closure.is_reachable(a, b) !=
+                     is_reachable(mesh, a, b, workspace));
+            }
+        }
+
+        printf("\ninterval index and is_reachable match closure, interval 0->4, 4->0 (expect 0, 1 0) : \n");
+        printf("%zu, %i %i\n",
+               mismatches,
+               int(interval_index<uint32_t>(graph).is_reachable(0u, 4u)),
+               int(interval_index<uint32_t>(graph).is_reachable(4u, 0u)));
+    }
+
+    {
+        std::vector<edge_type> adopted_edges = edges;
+
+        dag_type adopted(std::move(adopted_edges));
+
+        printf("\nadopted topological order (expect 0, 1, 3, 2, 4): \n");
+        for(auto &n : adopted.get_sorted_nodes())
+        {
+            printf("%i\n", n);
+        }
+
+        printf("\nadopted edges by dst (expect dst order 1, 2, 3, 4, 4)\n");
+
+        for(auto &e : adopted.get_edges_by_dst())
+        {
+            printf("%i, %i\n", e.get_src(), e.get_dst());
+        }
+    }
+
+    {
+        dag_options options;
+        options.compute_levels = true;
+
+        dag_type levelled(options, edges.begin(), edges.end());
+
+        printf("\nlevels (expect 0 | 1 3 | 2 | 4) : \n");
+
+        for(size_t level = 0; level < levelled.get_level_count(); ++level)
+        {
+            for(auto n : levelled.get_level_nodes(level))
+            {
+                printf("%i ", levelled.id_of(n));
+            }
+
+            printf(level + 1 < levelled.get_level_count() ? "| " : "\n");
+        }
+
+        options.order = topological_order::level_major;
+
+        dag_type level_major(options, edges.begin(), edges.end());
+
+        printf("\nlevel-major order (expect 0 1 3 2 4) : \n");
+
+        for(auto n : level_major.get_sorted_nodes())
+        {
+            printf("%i ", n);
+        }
+
+        printf("\n");
+
+        printf("\nlevel of 4, levels without option (expect 3, 0) : \n");
+        printf("%i, %i\n",
+               int(levelled.get_level(levelled.index_of(4))),
+               int(graph.get_has_levels()));
+
+        levelled.add_node(9);
+
+        printf("\nlevel of 4 and size of level 0 after an edit, level 0 without option (expect -1 0 0) : \n");
+        printf("%i %zu %zu\n",
+               int(levelled.get_level(levelled.index_of(4))),
+               levelled.get_level_nodes(0).size(),
+               graph.get_level_nodes(0).size());
+
+        printf("\nresorted level-major with levels: valid, level of 4, of 9 (expect 1 3 0) : \n");
+        bool resorted = levelled.resort(options);
+
+        printf("%i %i %i\n",
+               int(resorted),
+               int(levelled.get_level(levelled.index_of(4))),
+               int(levelled.get_level(levelled.index_of(9))));
+    }
+
+    {
+        printf("\nrank of 0, 3, 4, 9, node at rank 2 (expect 0 2 4 -1, 3) : \n");
+        printf("%i %i %i %i, %i\n",
+               int(graph.rank_of(0)),
+               int(graph.rank_of(3)),
+               int(graph.rank_of(4)),
+               int(graph.rank_of(9)),
+               graph.node_at_rank(2));
+    }
+
+    {
+        // An edited graph should look just like one built from its edges.
+        auto matches_rebuild = [](dag_type const &edited)
+        {
+            dag_options options;
+            options.storage = edited.get_edge_storage();
+
+            auto &by_src = edited.get_edges_by_src();
+            auto &nodes = edited.get_all_nodes();
+
+            dag_type rebuilt(
+                options, by_src.begin(), by_src.end(), nodes.begin(), nodes.end());
+
+            // Edges with the same key may be in any order, so compare
+            // sorted copies.
+            auto sorted_edges = [](auto const &edges)
+            {
+                std::vector<std::pair<uint32_t, uint32_t>> out;
+
+                for(auto const &e : edges)
+                {
+                    out.emplace_back(e.get_src(), e.get_dst());
+                }
+
+                std::sort(out.begin(), out.end());
+                return out;
+            };
+
+            auto &by_dst = edited.get_edges_by_dst();
+
+            bool match =
+                rebuilt.get_valid() &&
+                (rebuilt.get_all_nodes() == nodes) &&
+                (rebuilt.get_root_indices() == edited.get_root_indices()) &&
+                (sorted_edges(by_src) == sorted_edges(rebuilt.get_edges_by_src())) &&
+                (sorted_edges(by_dst) == sorted_edges(by_src)) &&
+                std::is_sorted(
+                    by_src.begin(),
+                    by_src.end(),
+                    [](auto const &a, auto const &b){return a.get_src() < b.get_src();}) &&
+                std::is_sorted(
+                    by_dst.begin(),
+                    by_dst.end(),
+                    [](auto const &a, auto const &b){return a.get_dst() < b.get_dst();});
+
+            for(uint32_t i = 0; match && (i < nodes.size()); ++i)
+            {
+                auto a = rebuilt.get_successors(i), b = edited.get_successors(i);
+                auto c = rebuilt.get_predecessors(i), d = edited.get_predecessors(i);
+
+                match =
+                    std::equal(a.begin(), a.end(), b.begin(), b.end()) &&
+                    std::equal(c.begin(), c.end(), d.begin(), d.end()) &&
+                    (edited.node_at_rank(edited.rank_of(nodes[i])) == nodes[i]);
+            }
+
+            for(auto &e : by_src)
+            {
+                match = match && (edited.rank_of(e.get_src()) < edited.rank_of(e.get_dst()));
+            }
+
+            return match && (edited.get_sorted_nodes().size() == nodes.size());
+        };
+
+        dag_type edited = graph;
+
+        printf("\nadd 4->0, 2->3, 7->0, node 5, 5->1 (expect 0 1 1 1 1) : \n");
+        int added[] =
+        {
+            edited.add_edge(4, 0),
+            edited.add_edge(2, 3),
+            edited.add_edge(7, 0),
+            edited.add_node(5),
+            edited.add_edge(5, 1)
+        };
+
+        for(auto a : added)
+        {
+            printf("%i ", a);
+        }
+
+        printf("\n");
+
+        printf("\nedited order (expect 7 0 5 1 2 3 4) : \n");
+
+        for(auto n : edited.get_sorted_nodes())
+        {
+            printf("%i ", n);
+        }
+
+        printf("\n");
+
+        // Random edits, checked against would_create_cycle and a rebuild.
+        size_t mismatches = 0;
+
+        for(auto storage : {edge_storage::dual, edge_storage::single})
+        {
+            dag_options options;
+            options.storage = storage;
+
+            std::vector<edge_type> no_edges;
+            dag_type random_graph(options, no_edges.begin(), no_edges.end());
+
+            uint32_t seed = 1;
+
+            for(int i = 0; i < 3000; ++i)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                uint32_t a = (seed >> 8) % 300u;
+                seed = seed * 1664525u + 1013904223u;
+                uint32_t b = (seed >> 8) % 300u;
+
+                bool cycle = would_create_cycle(random_graph, a, b);
+
+                mismatches += (random_graph.add_edge(a, b) == cycle);
+            }
+
+            mismatches += !matches_rebuild(random_graph);
+
+            // Remove some edges one at a time and some in a batch, then
+            // some nodes one at a time and some in a batch.
+            auto some_edges = random_graph.get_edges_by_src();
+            std::vector<edge_type> batch_edges;
+            std::vector<uint32_t> batch_nodes;
+
+            for(size_t i = 0; i < some_edges.size(); i += 5)
+            {
+                if(i % 2 == 0)
+                {
+                    mismatches += !random_graph.remove_edge(
+                        some_edges[i].get_src(), some_edges[i].get_dst());
+                }
+                else
+                {
+                    batch_edges.push_back(some_edges[i]);
+                }
+            }
+
+            random_graph.remove_edges(batch_edges.begin(), batch_edges.end());
+            mismatches += !matches_rebuild(random_graph);
+
+            for(uint32_t id = 0; id < 300u; id += 7u)
+            {
+                if(id % 2 == 0)
+                {
+                    random_graph.remove_node(id);
+                }
+                else
+                {
+                    batch_nodes.push_back(id);
+                }
+            }
+
+            random_graph.remove_nodes(batch_nodes.begin(), batch_nodes.end());
+            mismatches += !matches_rebuild(random_graph);
+            mismatches += (random_graph.rank_of(7u) != dag_type::invalid_index);
+
+            // Deltas, some of which make cycles, against rebuilds.
+            for(int round = 0; round < 20; ++round)
+            {
+                std::vector<edge_type> added, removed;
+                auto &current = random_graph.get_edges_by_src();
+
+                for(size_t i = round; i < current.size(); i += 11)
+                {
+                    removed.push_back(current[i]);
+                }
+
+                for(int i = 0; i < 3 + round; ++i)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    uint32_t a = (seed >> 8) % 320u;
+                    seed = seed * 1664525u + 1013904223u;
+                    uint32_t b = (seed >> 8) % 320u;
+
+                    added.emplace_back(a, b);
+                }
+
+                std::vector<edge_type> expected;
+
+                for(auto &e : current)
+                {
+                    bool dropped = false;
+
+                    for(auto &r : removed)
+                    {
+                        dropped = dropped ||
+                            ((r.get_src() == e.get_src()) && (r.get_dst() == e.get_dst()));
+                    }
+
+                    if(!dropped)
+                    {
+                        expected.push_back(e);
+                    }
+                }
+
+                expected.insert(expected.end(), added.begin(), added.end());
+
+                auto &nodes = random_graph.get_all_nodes();
+                dag_type rebuilt(
+                    options, expected.begin(), expected.end(), nodes.begin(), nodes.end());
+
+                auto edge_count = current.size();
+                bool applied = random_graph.apply_delta(added, removed);
+
+                mismatches +=
+                    (applied != rebuilt.get_valid()) ||
+                    !matches_rebuild(random_graph) ||
+                    (applied && (random_graph.get_all_nodes() != rebuilt.get_all_nodes())) ||
+                    (!applied && (random_graph.get_edges_by_src().size() != edge_count));
+            }
+        }
+
+        printf("\nrandom additions, removals and deltas match rebuilds, edited graph does (expect 0, 1) : \n");
+        printf("%zu, %i\n", mismatches, int(matches_rebuild(edited)));
+
+        // A snapshot shares storage until the original is edited, and
+        // keeps the old version after.
+        auto snapshot = edited.snapshot();
+        auto edge_count = snapshot.get_edges_by_src().size();
+        bool shared = (&snapshot.get_edges_by_src() == &edited.get_edges_by_src());
+
+        edited.add_edge(8, 9);
+        edited.remove_edge(4, 0);
+
+        printf("\nsnapshot shared, unshared by edits, unchanged, both consistent (expect 1 0 1 1) : \n");
+        printf("%i %i %i %i\n",
+               int(shared),
+               int(&snapshot.get_edges_by_src() == &edited.get_edges_by_src()),
+               int((snapshot.get_edges_by_src().size() == edge_count) &&
+                   (snapshot.rank_of(8) == dag_type::invalid_index)),
+               int(matches_rebuild(snapshot) && matches_rebuild(edited)));
+
+        // Tens of thousands of nodes and edges span many chunks and row
+        // blocks.  Edges added in the middle split chunks and batch
+        // removals merge them, on the graph and on a snapshot of it, and
+        // each must keep its own contents.
+        size_t chunked_mismatches = 0;
+
+        auto same_edges = [](dag_type const &g, std::vector<edge_type> const &expected)
+        {
+            auto &by_src = g.get_edges_by_src();
+
+            return std::equal(
+                by_src.begin(),
+                by_src.end(),
+                expected.begin(),
+                expected.end(),
+                [](auto const &a, auto const &b)
+                {
+                    return (a.get_src() == b.get_src()) && (a.get_dst() == b.get_dst());
+                });
+        };
+
+        for(auto storage : {edge_storage::dual, edge_storage::single})
+        {
+            dag_options options;
+            options.storage = storage;
+
+            uint32_t seed = 7;
+
+            auto random_below = [&seed](uint32_t range)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                return (seed >> 8) % range;
+            };
+
+            // Edges only go from lower ids to higher, so none make a
+            // cycle.  Nodes start with even ids, leaving odd ones to add
+            // in the middle.
+            std::vector<edge_type> big_edges;
+
+            while(big_edges.size() < 120000)
+            {
+                auto a = 2 * random_below(40000), b = 2 * random_below(40000);
+
+                if(a != b)
+                {
+                    big_edges.emplace_back(std::min(a, b), std::max(a, b));
+                }
+            }
+
+            dag_type big(options, big_edges.begin(), big_edges.end());
+
+            // Many edges between a few nodes land in one chunk of each
+            // edge array, splitting it.
+            for(int i = 0; i < 6000; ++i)
+            {
+                if(i % 60 == 0)
+                {
+                    big.add_node(2 * random_below(40000) + 1);
+                }
+
+                chunked_mismatches += !big.add_edge(
+                    20000 + 2 * random_below(50),
+                    60000 + 2 * random_below(100));
+            }
+
+            chunked_mismatches += !matches_rebuild(big);
+
+            auto before = big.snapshot();
+            auto before_edges = before.get_edges_by_src();
+
+            // Some edges one at a time, then every edge out of a run of
+            // ids, then some nodes one at a time and more in a batch.
+            auto some_edges = big.get_edges_by_src();
+            std::vector<edge_type> batch_edges;
+            std::vector<uint32_t> batch_nodes;
+
+            for(size_t i = 0; i < some_edges.size(); i += 97)
+            {
+                big.remove_edge(some_edges[i].get_src(), some_edges[i].get_dst());
+            }
+
+            for(auto &e : some_edges)
+            {
+                if((e.get_src() >= 20000) && (e.get_src() < 40000))
+                {
+                    batch_edges.push_back(e);
+                }
+            }
+
+            big.remove_edges(batch_edges.begin(), batch_edges.end());
+            chunked_mismatches += !matches_rebuild(big);
+
+            for(uint32_t id = 0; id < 60000; id += 3)
+            {
+                if(id % 3000 == 0)
+                {
+                    big.remove_node(id);
+                }
+                else
+                {
+                    batch_nodes.push_back(id);
+                }
+            }
+
+            big.remove_nodes(batch_nodes.begin(), batch_nodes.end());
+            chunked_mismatches += !matches_rebuild(big);
+
+            chunked_mismatches += !same_edges(before, before_edges);
+
+            // Edges added after the merges land in the merged chunks.
+            auto add_spread_edges = [&](dag_type &g)
+            {
+                for(int i = 0; i < 500; ++i)
+                {
+                    auto a = 2 * random_below(40000), b = 2 * random_below(40000);
+
+                    if((a != b) && (g.index_of(a) != dag_type::invalid_index) &&
+                       (g.index_of(b) != dag_type::invalid_index))
+                    {
+                        chunked_mismatches += !g.add_edge(std::min(a, b), std::max(a, b));
+                    }
+                }
+            };
+
+            add_spread_edges(big);
+            chunked_mismatches += !matches_rebuild(big);
+
+            // Edit the snapshot the same way, leaving the graph alone.
+            auto after_edges = big.get_edges_by_src();
+
+            before.remove_edges(before_edges.begin(), before_edges.begin() + 30000);
+            add_spread_edges(before);
+
+            chunked_mismatches +=
+                !matches_rebuild(before) ||
+                !same_edges(big, after_edges) ||
+                (before.get_edge_count() == before_edges.size());
+        }
+
+        printf("\nmulti-chunk edits, removals and snapshot edits match rebuilds (expect 0) : \n");
+        printf("%zu\n", chunked_mismatches);
+    }
+
+    {
+        std::vector<edge_type> cycle_edges = edges;
+
+        cycle_edges.emplace_back(4, 1);
+
+        dag_type cycle_graph(cycle_edges.begin(), cycle_edges.end());
+
+        printf("\nvalid with 4->1 added (expect 0, 0 sorted nodes) : \n");
+        printf("%i, %zu\n",
+               int(cycle_graph.get_valid()),
+               cycle_graph.get_sorted_nodes().size());
+
+        transitive_closure<uint32_t> cycle_closure(cycle_graph);
+
+        printf("\nclosure of the cycle: reachable 0->4, by index, row size (expect 0 0 0) : \n");
+        printf("%i %i %zu\n",
+               int(cycle_closure.is_reachable(0u, 4u)),
+               int(cycle_closure.is_reachable_index(
+                   cycle_graph.index_of(0), cycle_graph.index_of(4))),
+               cycle_closure.get_row(cycle_graph.index_of(0)).size());
+
+        interval_index<uint32_t> cycle_intervals(cycle_graph);
+        traversal_workspace<uint32_t> workspace;
+
+        printf("\nintervals of the cycle: valid, reachable 0->4 by index (expect 0 0) : \n");
+        printf("%i %i\n",
+               int(cycle_intervals.get_valid()),
+               int(cycle_intervals.is_reachable_index(
+                   cycle_graph.index_of(0), cycle_graph.index_of(4), workspace)));
+    }
+
+    {
+        // Indexes remember the graph as it was built, though they must
+        // be rebuilt after editing it.
+        dag_type edited = graph;
+        transitive_closure<uint32_t> closure(edited);
+
+        edited.add_edge(4, 5);
+
+        printf("\nclosure after an edit: valid, nodes reached from 0 (expect 1 4) : \n");
+
+        std::vector<uint32_t> out;
+        closure.find_all_after(0u, out);
+
+        printf("%i %zu\n", int(closure.get_valid()), out.size());
+    }
+
+    {
+        // Several threads completing tasks at once.  Released tasks go on a
+        // shared array that every task should be appended to exactly once.
+        std::vector<edge_type> layered_edges;
+
+        for(uint32_t i = 0; i < 50000; ++i)
+        {
+            layered_edges.emplace_back(i % 64u, 64u + ((i * 31u) % 4000u));
+            layered_edges.emplace_back(64u + (i % 4000u), 4064u + ((i * 17u) % 2000u));
+            layered_edges.emplace_back(4064u + (i % 2000u), 6064u + (i % 16u));
+        }
+
+        dag_type layered_graph(layered_edges.begin(), layered_edges.end());
+        concurrent_ready_tracker<uint32_t> tracker(layered_graph);
+
+        auto node_count = layered_graph.get_all_nodes().size();
+        std::unique_ptr<std::atomic<uint32_t>[]> released(
+            new std::atomic<uint32_t>[node_count]);
+        std::atomic<size_t> head(0), tail(0), errors(0);
+
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            released[i] = dag_type::invalid_index;
+        }
+
+        auto release = [&](uint32_t index)
+        {
+            auto slot = tail++;
+
+            if(slot < node_count)
+            {
+                released[slot] = index;
+            }
+            else
+            {
+                ++errors;
+            }
+        };
+
+        for(auto index : layered_graph.get_root_indices())
+        {
+            release(index);
+        }
+
+        std::vector<std::thread> threads;
+
+        for(int t = 0; t < 8; ++t)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    for(size_t slot = head++; slot < node_count; slot = head++)
+                    {
+                        uint32_t index;
+
+                        while((index = released[slot]) == dag_type::invalid_index)
+                        {
+                            std::this_thread::yield();
+                        }
+
+                        for(auto src : layered_graph.get_predecessors(index))
+                        {
+                            if(!tracker.get_done(layered_graph.id_of(src)))
+                            {
+                                ++errors;
+                            }
+                        }
+
+                        if(!tracker.mark_done_index(index, release))
+                        {
+                            ++errors;
+                        }
+                    }
+                });
+        }
+
+        for(auto &t : threads)
+        {
+            t.join();
+        }
+
+        printf("\nconcurrent tracker released every task once (expect 1, 0) : \n");
+        printf("%i, %zu\n", int(tracker.get_finished()), errors.load());
+    }
+
+    {
+        // Readers check every version they see while one writer keeps
+        // publishing.  Each update adds a node above all the others, so
+        // the largest id a reader sees should never go down.
+        std::vector<edge_type> random_edges;
+        std::mt19937 rng(7);
+        std::uniform_int_distribution<uint32_t> pick(0, 1999);
+
+        for(int i = 0; i < 8000; ++i)
+        {
+            auto a = pick(rng), b = pick(rng);
+
+            if(a != b)
+            {
+                random_edges.emplace_back(std::min(a, b), std::max(a, b));
+            }
+        }
+
+        concurrent_dag<uint32_t> shared_graph(
+            dag_type(random_edges.begin(), random_edges.end()), 4);
+
+        std::atomic<bool> done(false);
+        std::atomic<int> registered(0);
+        std::atomic<size_t> mismatches(0), stale(0);
+        std::vector<std::thread> readers;
+
+        for(int t = 0; t < 4; ++t)
+        {
+            readers.emplace_back(
+                [&, t]
+                {
+                    auto handle = shared_graph.register_reader();
+                    uint32_t newest = 0;
+
+                    ++registered;
+
+                    while(!done.load())
+                    {
+                        auto guard = handle.read();
+                        auto &graph = *guard;
+                        auto &by_src = graph.get_edges_by_src();
+
+                        if(graph.get_all_nodes().back() < newest)
+                        {
+                            ++stale;
+                        }
+
+                        newest = graph.get_all_nodes().back();
+
+                        bool ok =
+                            graph.get_valid() &&
+                            (graph.get_sorted_nodes().size() == graph.get_all_nodes().size());
+
+                        for(size_t i = size_t(t); ok && (i < by_src.size()); i += 16)
+                        {
+                            ok = graph.rank_of(by_src[i].get_src()) < graph.rank_of(by_src[i].get_dst());
+                        }
+
+                        mismatches += !ok;
+                    }
+                });
+        }
+
+        while(registered.load() != 4)
+        {
+            std::this_thread::yield();
+        }
+
+        for(uint32_t version = 0; version < 300; ++version)
+        {
+            shared_graph.update(
+                [&](dag_type &next)
+                {
+                    next.add_node(100000 + version);
+                    next.add_edge(pick(rng), pick(rng));
+                    next.remove_edge(next.get_edges_by_src()[0].get_src(),
+                                     next.get_edges_by_src()[0].get_dst());
+                    return true;
+                });
+        }
+
+        auto extra = shared_graph.register_reader();
+
+        done = true;
+
+        for(auto &t : readers)
+        {
+            t.join();
+        }
+
+        shared_graph.reclaim();
+
+        printf("\nconcurrent readers saw consistent, current versions, extra reader refused, all reclaimed (expect 0 0 0 0) : \n");
+        printf("%zu %zu %i %zu\n",
+               mismatches.load(),
+               stale.load(),
+               int(extra.get_valid()),
+               shared_graph.get_retired_count());
+    }
+
+    {
+        // Check every task starts after all the tasks before it finished.
+        dag_executor executor(4);
+
+        std::vector<edge_type> wide_edges;
+
+        for(uint32_t i = 0; i < 20000; ++i)
+        {
+            wide_edges.emplace_back(i % 100u, 100u + (i % 5000u));
+            wide_edges.emplace_back(100u + (i % 5000u), 5100u + (i % 3u));
+        }
+
+        dag_type wide_graph(wide_edges.begin(), wide_edges.end());
+
+        auto node_count = wide_graph.get_all_nodes().size();
+        std::unique_ptr<std::atomic<int>[]> finished(new std::atomic<int>[node_count]);
+        std::atomic<size_t> run_count(0), out_of_order(0);
+
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            finished[i] = 0;
+        }
+
+        executor.run(
+            wide_graph,
+            [&](uint32_t id)
+            {
+                auto index = wide_graph.index_of(id);
+
+                for(auto src : wide_graph.get_predecessors(index))
+                {
+                    if(finished[src] == 0)
+                    {
+                        ++out_of_order;
+                    }
+                }
+
+                ++run_count;
+                finished[index] = 1;
+            });
+
+        printf("\nexecutor ran all tasks in order (expect 1) : \n");
+        printf("%i\n", int((run_count == node_count) && (out_of_order == 0)));
+
+        bool caught = false;
+
+        try
+        {
+            executor.run(
+                graph,
+                [](uint32_t id)
+                {
+                    if(id == 1)
+                    {
+                        throw std::runtime_error("task failed");
+                    }
+                });
+        }
+        catch(std::runtime_error const &)
+        {
+            caught = true;
+        }
+
+        printf("\nexecutor rethrows task exceptions (expect 1) : \n");
+        printf("%i\n", int(caught));
+    }
+
+    {
+        // Too few edges for a radix sort, so the dst order comes from the
+        // comparison sort, which must still keep each dst in src order.
+        std::vector<edge_type> shared_dst_edges;
+
+        for(uint32_t i = 0; i < 2000; ++i)
+        {
+            shared_dst_edges.emplace_back((i * 7919u) % 1500u, 1500u + (i % 7u));
+        }
+
+        dag_options options;
+        options.storage = edge_storage::single;
+
+        for(unsigned threads : {1u, 8u})
+        {
+            options.thread_count = threads;
+
+            dag_type single_graph(options, shared_dst_edges.begin(), shared_dst_edges.end());
+
+            auto &by_dst = single_graph.get_edges_by_dst();
+
+            printf("\nsingle storage edges by dst in src order, %u threads (expect 1) : \n", threads);
+            printf("%i\n",
+                   int(std::is_sorted(
+                       by_dst.begin(),
+                       by_dst.end(),
+                       [](auto const &a, auto const &b)
+                       {
+                           return
+                               (a.get_dst() < b.get_dst()) ||
+                               ((a.get_dst() == b.get_dst()) && (a.get_src() < b.get_src()));
+                       })));
+        }
+    }
+
+    {
+        // Large enough that the sorts really are split across threads.
+        std::vector<edge_type> big_edges;
+
+        for(uint32_t i = 0; i < 100000; ++i)
+        {
+            big_edges.emplace_back((i * 7919u) % 50000u, 50000u + (i % 1000u));
+            big_edges.emplace_back(50000u + (i % 1000u), 60000u + (i % 77u));
+        }
+
+        dag_options options;
+        options.thread_count = 4;
+
+        dag_type serial_graph(big_edges.begin(), big_edges.end());
+        dag_type parallel_graph(options, big_edges.begin(), big_edges.end());
+
+        options.storage = edge_storage::single;
+
+        dag_type single_graph(options, big_edges.begin(), big_edges.end());
+
+        printf("\nparallel builds match serial build (expect 1, 1) : \n");
+
+        for(auto *graph : {&parallel_graph, &single_graph})
+        {
+            printf("%i\n",
+                   int(graph->get_valid() &&
+                       (serial_graph.get_all_nodes() ==
+                        graph->get_all_nodes()) &&
+                       (serial_graph.get_sorted_nodes() ==
+                        graph->get_sorted_nodes())));
+        }
+
+        auto &by_dst = single_graph.get_edges_by_dst();
+
+        printf("\nsingle storage edges by dst sorted (expect 1) : \n");
+        printf("%i\n",
+               int((by_dst.size() == big_edges.size()) &&
+                   std::is_sorted(
+                       by_dst.begin(),
+                       by_dst.end(),
+                       [](auto const &a, auto const &b){return a.get_dst() < b.get_dst();})));
+
+        // The view reads the same edges off the adjacency, and an edit
+        // drops the copy.
+        auto view = single_graph.get_edges_by_dst_view();
+        bool view_matches = std::equal(
+            view.begin(),
+            view.end(),
+            by_dst.begin(),
+            by_dst.end(),
+            [](auto const &a, auto const &b)
+            {
+                return (a.get_src() == b.get_src()) && (a.get_dst() == b.get_dst());
+            });
+
+        single_graph.add_edge(0u, 70000u);
+
+        printf("\nsingle storage view matches, copy follows edits (expect 1 1) : \n");
+        printf("%i %i\n",
+               int(view_matches),
+               int(single_graph.get_edges_by_dst().back().get_dst() == 70000u));
+
+        options.storage = edge_storage::dual;
+        options.compute_levels = true;
+
+        dag_type kahn_graph(options, big_edges.begin(), big_edges.end());
+
+        options.order = topological_order::level_major;
+
+        dag_type level_graph(options, big_edges.begin(), big_edges.end());
+
+        options.thread_count = 1;
+
+        dag_type serial_level_graph(options, big_edges.begin(), big_edges.end());
+
+        // Level-major order is the kahn levels laid end to end.
+        std::vector<uint32_t> kahn_levels;
+
+        for(size_t level = 0; level < kahn_graph.get_level_count(); ++level)
+        {
+            for(auto n : kahn_graph.get_level_nodes(level))
+            {
+                kahn_levels.push_back(kahn_graph.id_of(n));
+            }
+        }
+
+        printf("\nlevel-major order matches levels, serial build (expect 1, 1, 1) : \n");
+        printf("%i, %i, %i\n",
+               int(level_graph.get_sorted_nodes() == kahn_levels),
+               int(level_graph.get_level_count() == kahn_graph.get_level_count()),
+               int(level_graph.get_sorted_nodes() ==
+                   serial_level_graph.get_sorted_nodes()));
+    }
+
+    {
+        // Enough edges to be radix sorted, with negative ids.
+        using signed_dag_type = dag<int32_t>;
+
+        std::vector<typename signed_dag_type::edge_type> chain_edges;
+
+        for(int32_t i = 2999; i >= -3000; --i)
+        {
+            chain_edges.emplace_back(i, i + 1);
+        }
+
+        signed_dag_type chain(chain_edges.begin(), chain_edges.end());
+
+        printf("\nsigned chain first, last, count (expect -3000, 3000, 6001) : \n");
+        printf("%i, %i, %zu\n",
+               chain.get_sorted_nodes().front(),
+               chain.get_sorted_nodes().back(),
+               chain.get_sorted_nodes().size());
+    }
+
+    {
+        // Sparse 64 bit ids, as you'd get from hashing names.
+        using sparse_dag_type   = dag<uint64_t>;
+        using sparse_edge_type  = typename sparse_dag_type::edge_type;
+
+        std::vector<sparse_edge_type> sparse_edges;
+
+        sparse_edges.emplace_back(0x9e3779b97f4a7c15ull, 0x0000000000000007ull);
+        sparse_edges.emplace_back(0x0000000000000007ull, 0xbf58476d1ce4e5b9ull);
+
+        sparse_dag_type sparse_graph(sparse_edges.begin(), sparse_edges.end());
+
+        printf("\nindices of sparse ids (expect 1, 0, 2, missing) : \n");
+
+        for(auto id : {0x9e3779b97f4a7c15ull,
+                       0x0000000000000007ull,
+                       0xbf58476d1ce4e5b9ull,
+                       0x0000000000000008ull})
+        {
+            auto index = sparse_graph.index_of(id);
+
+            if(index == sparse_dag_type::invalid_index)
+            {
+                printf("missing\n");
+            }
+            else
+            {
+                printf("%u\n", index);
+            }
+        }
+    }
+
     return 0;
 }